@@ -0,0 +1,428 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace graph {
+
+    // Bidirectional Dijkstra: a forward search from the source and a backward
+    // one from the target meet in the middle, so each settles roughly the
+    // vertices within half the route length.
+    // With landmarks it becomes ALT (A*, landmarks, triangle inequality):
+    // distances to and from a few far-apart landmarks, computed once, give
+    // lower bounds on the remaining distance that steer both searches
+    // towards each other. The searches use the average of the forward and
+    // backward bounds, which keeps them consistent with each other.
+    // Expects a frozen graph. Scratch buffers are reused between queries, so
+    // BuildRoute must not be called concurrently on the same instance.
+    template <typename Weight>
+    class BidirectionalRouter : public RouteEngine<Weight> {
+    private:
+        using Graph = DirectedWeightedGraph<Weight>;
+
+    public:
+        // landmark_count == 0 gives plain bidirectional Dijkstra.
+        explicit BidirectionalRouter(const Graph& graph, size_t landmark_count = 0);
+
+        using RouteInfo = graph::RouteInfo<Weight>;
+
+        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const override;
+
+        SearchStats GetSearchStats() const override {
+            return stats_;
+        }
+
+        const std::vector<VertexId>& GetLandmarks() const {
+            return landmarks_;
+        }
+
+    private:
+        static constexpr Weight ZERO_WEIGHT{};
+        static constexpr Weight INFINITE_WEIGHT = std::numeric_limits<Weight>::max();
+        static constexpr EdgeId NO_EDGE = std::numeric_limits<EdgeId>::max();
+
+        struct QueueItem {
+            Weight key;
+            VertexId vertex;
+
+            bool operator>(const QueueItem& other) const {
+                return key > other.key;
+            }
+        };
+
+        // One direction of the search; keys are distances plus potentials.
+        struct SearchSide {
+            std::vector<std::optional<Weight>> weights;
+            std::vector<EdgeId> prev_edges;
+            std::vector<VertexId> touched;
+            std::vector<QueueItem> queue;
+
+            explicit SearchSide(size_t vertex_count)
+                : weights(vertex_count)
+                , prev_edges(vertex_count, NO_EDGE) {
+            }
+
+            void Reset() {
+                for (const VertexId vertex : touched) {
+                    weights[vertex].reset();
+                    prev_edges[vertex] = NO_EDGE;
+                }
+                touched.clear();
+                queue.clear();
+            }
+
+            void Reach(VertexId vertex, Weight weight, Weight key, EdgeId prev_edge) {
+                if (!weights[vertex]) {
+                    touched.push_back(vertex);
+                }
+                weights[vertex] = weight;
+                prev_edges[vertex] = prev_edge;
+                queue.push_back({key, vertex});
+                std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+            }
+
+            QueueItem Pop() {
+                std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+                const QueueItem item = queue.back();
+                queue.pop_back();
+                return item;
+            }
+        };
+
+        void BuildReverseArcs();
+        // Distances from source to every vertex, or from every vertex to
+        // source when reverse is set; INFINITE_WEIGHT where there is no route.
+        std::vector<Weight> ComputeDistances(VertexId source, bool reverse) const;
+        void ChooseLandmarks(size_t landmark_count);
+
+        Weight GetLandmarkDistance(const std::vector<Weight>& table, VertexId vertex, size_t landmark) const {
+            return table[vertex * landmarks_.size() + landmark];
+        }
+
+        // Lower bound on the distance from `from` to `to`. Landmarks that
+        // cannot reach or be reached from one of them give no bound.
+        Weight ComputeLowerBound(VertexId from, VertexId to) const;
+        // Whether some landmark proves that there is no route.
+        bool IsProvablyUnreachable(VertexId from, VertexId to) const;
+        // Forward potential of vertex; the backward search uses its negation.
+        Weight GetPotential(VertexId vertex) const;
+
+        const Graph& graph_;
+
+        std::vector<size_t> reverse_offsets_;
+        std::vector<VertexId> reverse_sources_;
+        std::vector<Weight> reverse_weights_;
+        std::vector<EdgeId> reverse_edge_ids_;
+
+        std::vector<VertexId> landmarks_;
+        // Vertex-major: distances of one vertex to all landmarks are adjacent.
+        std::vector<Weight> from_landmarks_;
+        std::vector<Weight> to_landmarks_;
+
+        mutable SearchSide forward_search_;
+        mutable SearchSide backward_search_;
+        mutable VertexId query_from_ = 0;
+        mutable VertexId query_to_ = 0;
+        mutable std::vector<std::optional<Weight>> potentials_;
+        mutable std::vector<VertexId> touched_potentials_;
+        mutable SearchStats stats_;
+    };
+
+    template <typename Weight>
+    BidirectionalRouter<Weight>::BidirectionalRouter(const Graph& graph, size_t landmark_count)
+        : graph_(graph)
+        , forward_search_(graph.GetVertexCount())
+        , backward_search_(graph.GetVertexCount())
+        , potentials_(graph.GetVertexCount())
+    {
+        if (!graph.IsFrozen()) {
+            throw std::logic_error("Graph should be frozen before building a router");
+        }
+        for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+            if (graph.GetEdge(edge_id).weight < ZERO_WEIGHT) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+        }
+        BuildReverseArcs();
+        ChooseLandmarks(std::min(landmark_count, graph.GetVertexCount()));
+    }
+
+    template <typename Weight>
+    void BidirectionalRouter<Weight>::BuildReverseArcs() {
+        const size_t vertex_count = graph_.GetVertexCount();
+        reverse_offsets_.assign(vertex_count + 1, 0);
+        for (EdgeId edge_id = 0; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+            ++reverse_offsets_[graph_.GetEdge(edge_id).to + 1];
+        }
+        for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            reverse_offsets_[vertex + 1] += reverse_offsets_[vertex];
+        }
+        reverse_sources_.resize(graph_.GetEdgeCount());
+        reverse_weights_.resize(graph_.GetEdgeCount());
+        reverse_edge_ids_.resize(graph_.GetEdgeCount());
+        std::vector<size_t> next_arc(reverse_offsets_.begin(), reverse_offsets_.end() - 1);
+        for (EdgeId edge_id = 0; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+            const auto& edge = graph_.GetEdge(edge_id);
+            const size_t arc = next_arc[edge.to]++;
+            reverse_sources_[arc] = edge.from;
+            reverse_weights_[arc] = edge.weight;
+            reverse_edge_ids_[arc] = edge_id;
+        }
+    }
+
+    template <typename Weight>
+    std::vector<Weight> BidirectionalRouter<Weight>::ComputeDistances(VertexId source, bool reverse) const {
+        std::vector<Weight> distances(graph_.GetVertexCount(), INFINITE_WEIGHT);
+        std::vector<QueueItem> queue{{ZERO_WEIGHT, source}};
+        distances[source] = ZERO_WEIGHT;
+        auto relax = [&](VertexId target, Weight weight) {
+            if (weight < distances[target]) {
+                distances[target] = weight;
+                queue.push_back({weight, target});
+                std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+            }
+        };
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+            const QueueItem item = queue.back();
+            queue.pop_back();
+            if (item.key > distances[item.vertex]) {
+                continue;
+            }
+            if (reverse) {
+                for (size_t arc = reverse_offsets_[item.vertex]; arc < reverse_offsets_[item.vertex + 1]; ++arc) {
+                    relax(reverse_sources_[arc], item.key + reverse_weights_[arc]);
+                }
+            } else {
+                const IncidentArcs<Weight> arcs = graph_.GetIncidentArcs(item.vertex);
+                for (size_t i = 0; i < arcs.size; ++i) {
+                    relax(arcs.targets[i], item.key + arcs.weights[i]);
+                }
+            }
+        }
+        return distances;
+    }
+
+    template <typename Weight>
+    void BidirectionalRouter<Weight>::ChooseLandmarks(size_t landmark_count) {
+        // Farthest-first: each new landmark is the vertex farthest (there and
+        // back) from all landmarks chosen so far. Only vertices connected both
+        // ways to the busiest vertex are candidates, so that isolated stops
+        // do not waste landmarks; the first round measures from that vertex.
+        const size_t vertex_count = graph_.GetVertexCount();
+        if (landmark_count == 0 || vertex_count == 0) {
+            return;
+        }
+        std::vector<std::vector<Weight>> from_tables;
+        std::vector<std::vector<Weight>> to_tables;
+        std::vector<Weight> closest(vertex_count, INFINITE_WEIGHT);
+        std::vector<bool> is_landmark(vertex_count, false);
+
+        auto update_closest = [&](const std::vector<Weight>& from, const std::vector<Weight>& to) {
+            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+                if (from[vertex] != INFINITE_WEIGHT && to[vertex] != INFINITE_WEIGHT) {
+                    closest[vertex] = std::min(closest[vertex], from[vertex] + to[vertex]);
+                }
+            }
+        };
+        auto farthest_vertex = [&]() -> std::optional<VertexId> {
+            std::optional<VertexId> best;
+            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+                if (!is_landmark[vertex] && closest[vertex] != INFINITE_WEIGHT
+                    && (!best || closest[*best] < closest[vertex])) {
+                    best = vertex;
+                }
+            }
+            return best;
+        };
+
+        VertexId seed = 0;
+        for (VertexId vertex = 1; vertex < vertex_count; ++vertex) {
+            if (graph_.GetIncidentArcs(vertex).size > graph_.GetIncidentArcs(seed).size) {
+                seed = vertex;
+            }
+        }
+        update_closest(ComputeDistances(seed, false), ComputeDistances(seed, true));
+        while (landmarks_.size() < landmark_count) {
+            const std::optional<VertexId> candidate = farthest_vertex();
+            if (!candidate) {
+                break;
+            }
+            const VertexId landmark = *candidate;
+            if (landmarks_.empty()) {
+                // The seed only served to find the first landmark.
+                std::fill(closest.begin(), closest.end(), INFINITE_WEIGHT);
+            }
+            landmarks_.push_back(landmark);
+            is_landmark[landmark] = true;
+            from_tables.push_back(ComputeDistances(landmark, false));
+            to_tables.push_back(ComputeDistances(landmark, true));
+            update_closest(from_tables.back(), to_tables.back());
+        }
+
+        from_landmarks_.resize(vertex_count * landmarks_.size());
+        to_landmarks_.resize(vertex_count * landmarks_.size());
+        for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            for (size_t landmark = 0; landmark < landmarks_.size(); ++landmark) {
+                from_landmarks_[vertex * landmarks_.size() + landmark] = from_tables[landmark][vertex];
+                to_landmarks_[vertex * landmarks_.size() + landmark] = to_tables[landmark][vertex];
+            }
+        }
+    }
+
+    template <typename Weight>
+    Weight BidirectionalRouter<Weight>::ComputeLowerBound(VertexId from, VertexId to) const {
+        Weight bound = ZERO_WEIGHT;
+        for (size_t landmark = 0; landmark < landmarks_.size(); ++landmark) {
+            // d(L, to) <= d(L, from) + d(from, to)
+            const Weight landmark_to = GetLandmarkDistance(from_landmarks_, to, landmark);
+            const Weight landmark_from = GetLandmarkDistance(from_landmarks_, from, landmark);
+            if (landmark_to != INFINITE_WEIGHT && landmark_from != INFINITE_WEIGHT) {
+                bound = std::max(bound, landmark_to - landmark_from);
+            }
+            // d(from, L) <= d(from, to) + d(to, L)
+            const Weight from_landmark = GetLandmarkDistance(to_landmarks_, from, landmark);
+            const Weight to_landmark = GetLandmarkDistance(to_landmarks_, to, landmark);
+            if (from_landmark != INFINITE_WEIGHT && to_landmark != INFINITE_WEIGHT) {
+                bound = std::max(bound, from_landmark - to_landmark);
+            }
+        }
+        return bound;
+    }
+
+    template <typename Weight>
+    bool BidirectionalRouter<Weight>::IsProvablyUnreachable(VertexId from, VertexId to) const {
+        for (size_t landmark = 0; landmark < landmarks_.size(); ++landmark) {
+            // `to` reaches L but `from` does not, or L reaches `from` but not `to`.
+            if ((GetLandmarkDistance(to_landmarks_, from, landmark) == INFINITE_WEIGHT
+                    && GetLandmarkDistance(to_landmarks_, to, landmark) != INFINITE_WEIGHT)
+                || (GetLandmarkDistance(from_landmarks_, to, landmark) == INFINITE_WEIGHT
+                    && GetLandmarkDistance(from_landmarks_, from, landmark) != INFINITE_WEIGHT)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Weight>
+    Weight BidirectionalRouter<Weight>::GetPotential(VertexId vertex) const {
+        if (landmarks_.empty()) {
+            return ZERO_WEIGHT;
+        }
+        auto& potential = potentials_[vertex];
+        if (!potential) {
+            touched_potentials_.push_back(vertex);
+            potential = (ComputeLowerBound(vertex, query_to_) - ComputeLowerBound(query_from_, vertex)) / 2;
+        }
+        return *potential;
+    }
+
+    template <typename Weight>
+    std::optional<typename BidirectionalRouter<Weight>::RouteInfo>
+    BidirectionalRouter<Weight>::BuildRoute(VertexId from, VertexId to) const {
+        if (from >= graph_.GetVertexCount() || to >= graph_.GetVertexCount()) {
+            throw std::out_of_range("Vertex id is out of range");
+        }
+        if (from == to) {
+            return RouteInfo{ZERO_WEIGHT, {}};
+        }
+        if (IsProvablyUnreachable(from, to)) {
+            return std::nullopt;
+        }
+
+        forward_search_.Reset();
+        backward_search_.Reset();
+        for (const VertexId vertex : touched_potentials_) {
+            potentials_[vertex].reset();
+        }
+        touched_potentials_.clear();
+        query_from_ = from;
+        query_to_ = to;
+        ++stats_.search_count;
+
+        forward_search_.Reach(from, ZERO_WEIGHT, GetPotential(from), NO_EDGE);
+        backward_search_.Reach(to, ZERO_WEIGHT, -GetPotential(to), NO_EDGE);
+
+        std::optional<Weight> best_weight;
+        VertexId meeting_vertex = from;
+        auto try_meet = [&](VertexId vertex) {
+            if (forward_search_.weights[vertex] && backward_search_.weights[vertex]) {
+                const Weight weight = *forward_search_.weights[vertex] + *backward_search_.weights[vertex];
+                if (!best_weight || weight < *best_weight) {
+                    best_weight = weight;
+                    meeting_vertex = vertex;
+                }
+            }
+        };
+
+        // With potentials p (forward) and -p (backward), the smallest keys
+        // of both queues add up to a lower bound on any route not found yet.
+        while (!forward_search_.queue.empty() && !backward_search_.queue.empty()) {
+            const Weight forward_key = forward_search_.queue.front().key;
+            const Weight backward_key = backward_search_.queue.front().key;
+            if (best_weight && !(forward_key + backward_key < *best_weight)) {
+                break;
+            }
+
+            const bool forward = forward_key <= backward_key;
+            SearchSide& side = forward ? forward_search_ : backward_search_;
+            const QueueItem item = side.Pop();
+            const Weight weight = *side.weights[item.vertex];
+            const Weight potential = forward ? GetPotential(item.vertex) : -GetPotential(item.vertex);
+            if (item.key > weight + potential) {
+                continue;
+            }
+            ++stats_.settled_vertex_count;
+
+            auto relax = [&](VertexId target, Weight arc_weight, EdgeId edge_id) {
+                const Weight candidate_weight = weight + arc_weight;
+                if (side.weights[target] && !(candidate_weight < *side.weights[target])) {
+                    return;
+                }
+                // Vertices proven off every route would break the bounds.
+                if (forward ? IsProvablyUnreachable(target, to) : IsProvablyUnreachable(from, target)) {
+                    return;
+                }
+                const Weight target_potential = forward ? GetPotential(target) : -GetPotential(target);
+                side.Reach(target, candidate_weight, candidate_weight + target_potential, edge_id);
+                try_meet(target);
+            };
+            if (forward) {
+                const IncidentArcs<Weight> arcs = graph_.GetIncidentArcs(item.vertex);
+                for (size_t i = 0; i < arcs.size; ++i) {
+                    relax(arcs.targets[i], arcs.weights[i], arcs.edge_ids[i]);
+                }
+            } else {
+                for (size_t arc = reverse_offsets_[item.vertex]; arc < reverse_offsets_[item.vertex + 1]; ++arc) {
+                    relax(reverse_sources_[arc], reverse_weights_[arc], reverse_edge_ids_[arc]);
+                }
+            }
+        }
+
+        if (!best_weight) {
+            return std::nullopt;
+        }
+
+        std::vector<EdgeId> edges;
+        for (VertexId vertex = meeting_vertex; forward_search_.prev_edges[vertex] != NO_EDGE;
+             vertex = graph_.GetEdge(forward_search_.prev_edges[vertex]).from) {
+            edges.push_back(forward_search_.prev_edges[vertex]);
+        }
+        std::reverse(edges.begin(), edges.end());
+        for (VertexId vertex = meeting_vertex; backward_search_.prev_edges[vertex] != NO_EDGE;
+             vertex = graph_.GetEdge(backward_search_.prev_edges[vertex]).to) {
+            edges.push_back(backward_search_.prev_edges[vertex]);
+        }
+
+        return RouteInfo{*best_weight, std::move(edges)};
+    }
+
+}
@@ -0,0 +1,549 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace graph {
+
+    // Contraction Hierarchies: vertices are contracted one by one in order of
+    // importance, and shortcut arcs keep the distances between the remaining
+    // ones. A query is a bidirectional Dijkstra that only moves up the order.
+    // Shortcuts remember the two arcs they replace, so routes are unpacked
+    // back to edges of the original graph.
+    // Scratch buffers are reused between queries, so BuildRoute must not be
+    // called concurrently on the same instance.
+    template <typename Weight>
+    class ContractionHierarchy : public RouteEngine<Weight> {
+    private:
+        using Graph = DirectedWeightedGraph<Weight>;
+
+    public:
+        explicit ContractionHierarchy(const Graph& graph);
+
+        using RouteInfo = graph::RouteInfo<Weight>;
+
+        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const override;
+        // Bucket-based many-to-many: one backward upward search per target
+        // leaves (target, weight) entries at every vertex it settles, then
+        // one forward upward search per source scans the buckets it meets.
+        void ComputeWeights(const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+                            const std::function<void(size_t, const typename RouteEngine<Weight>::WeightRow&)>& on_row)
+            const override;
+
+        size_t GetShortcutCount() const {
+            return shortcut_count_;
+        }
+
+        SearchStats GetSearchStats() const override {
+            return stats_;
+        }
+
+    private:
+        static constexpr Weight ZERO_WEIGHT{};
+        static constexpr EdgeId NO_EDGE = std::numeric_limits<EdgeId>::max();
+        static constexpr size_t NO_ARC = std::numeric_limits<size_t>::max();
+        // Witness searches give up after settling this many vertices and add
+        // the shortcut anyway; that only costs an unnecessary arc.
+        static constexpr size_t MAX_WITNESS_SETTLED = 200;
+
+        struct Arc {
+            VertexId from;
+            VertexId to;
+            Weight weight;
+            EdgeId edge_id;
+            size_t first_half;
+            size_t second_half;
+        };
+
+        struct SearchArc {
+            VertexId target;
+            Weight weight;
+            size_t arc_id;
+        };
+
+        struct QueueItem {
+            Weight weight;
+            VertexId vertex;
+
+            bool operator>(const QueueItem& other) const {
+                return weight > other.weight || (weight == other.weight && vertex > other.vertex);
+            }
+        };
+
+        // Dijkstra state with a list of touched vertices for cheap resets.
+        struct SearchSpace {
+            std::vector<std::optional<Weight>> weights;
+            std::vector<size_t> prev_arcs;
+            std::vector<VertexId> touched;
+            std::vector<QueueItem> queue;
+
+            explicit SearchSpace(size_t vertex_count = 0)
+                : weights(vertex_count)
+                , prev_arcs(vertex_count, NO_ARC) {
+            }
+
+            void Reset() {
+                for (const VertexId vertex : touched) {
+                    weights[vertex].reset();
+                    prev_arcs[vertex] = NO_ARC;
+                }
+                touched.clear();
+                queue.clear();
+            }
+
+            void Reach(VertexId vertex, Weight weight, size_t prev_arc) {
+                if (!weights[vertex]) {
+                    touched.push_back(vertex);
+                }
+                weights[vertex] = weight;
+                prev_arcs[vertex] = prev_arc;
+                queue.push_back({weight, vertex});
+                std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+            }
+
+            QueueItem Pop() {
+                std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+                const QueueItem item = queue.back();
+                queue.pop_back();
+                return item;
+            }
+        };
+
+        // The contraction overlay keeps at most one arc per vertex pair; an
+        // arc replaced by a cheaper one can never lie on a shortest path, so
+        // it is left out of the hierarchy.
+        bool InsertArc(const Arc& arc) {
+            for (size_t& arc_id : out_arcs_[arc.from]) {
+                if (arcs_[arc_id].to != arc.to) {
+                    continue;
+                }
+                if (!(arc.weight < arcs_[arc_id].weight)) {
+                    return false;
+                }
+                in_hierarchy_[arc_id] = false;
+                const size_t new_arc_id = PushArc(arc);
+                std::replace(in_arcs_[arc.to].begin(), in_arcs_[arc.to].end(), arc_id, new_arc_id);
+                arc_id = new_arc_id;
+                return true;
+            }
+            const size_t new_arc_id = PushArc(arc);
+            out_arcs_[arc.from].push_back(new_arc_id);
+            in_arcs_[arc.to].push_back(new_arc_id);
+            return true;
+        }
+
+        size_t PushArc(const Arc& arc) {
+            arcs_.push_back(arc);
+            in_hierarchy_.push_back(true);
+            return arcs_.size() - 1;
+        }
+
+        // Shortcuts needed between the uncontracted neighbours of vertex when
+        // it is removed: one per (u, w) pair whose path through vertex is
+        // shorter than any witness path around it.
+        std::vector<Arc> FindShortcuts(VertexId vertex) {
+            std::vector<Arc> shortcuts;
+            for (const size_t in_arc_id : in_arcs_[vertex]) {
+                const Arc in_arc = arcs_[in_arc_id];
+                Weight max_weight = ZERO_WEIGHT;
+                size_t target_count = 0;
+                for (const size_t out_arc_id : out_arcs_[vertex]) {
+                    const Arc& out_arc = arcs_[out_arc_id];
+                    if (out_arc.to != in_arc.from) {
+                        witness_limits_[out_arc.to] = in_arc.weight + out_arc.weight;
+                        witness_targets_[out_arc.to] = true;
+                        max_weight = std::max(max_weight, witness_limits_[out_arc.to]);
+                        ++target_count;
+                    }
+                }
+                if (target_count == 0) {
+                    continue;
+                }
+
+                RunWitnessSearch(in_arc.from, vertex, max_weight, target_count);
+                for (const size_t out_arc_id : out_arcs_[vertex]) {
+                    const Arc& out_arc = arcs_[out_arc_id];
+                    if (out_arc.to == in_arc.from) {
+                        continue;
+                    }
+                    witness_targets_[out_arc.to] = false;
+                    const Weight via_weight = in_arc.weight + out_arc.weight;
+                    const auto& witness_weight = witness_search_.weights[out_arc.to];
+                    if (!witness_weight || via_weight < *witness_weight) {
+                        shortcuts.push_back({in_arc.from, out_arc.to, via_weight, NO_EDGE, in_arc_id, out_arc_id});
+                    }
+                }
+            }
+            // Several arcs may lead through vertex between the same pair; the
+            // cheapest one is enough.
+            std::sort(shortcuts.begin(), shortcuts.end(), [](const Arc& lhs, const Arc& rhs) {
+                return std::tie(lhs.from, lhs.to, lhs.weight) < std::tie(rhs.from, rhs.to, rhs.weight);
+            });
+            shortcuts.erase(std::unique(shortcuts.begin(), shortcuts.end(), [](const Arc& lhs, const Arc& rhs) {
+                return lhs.from == rhs.from && lhs.to == rhs.to;
+            }), shortcuts.end());
+            return shortcuts;
+        }
+
+        // Searches from source around the excluded vertex until every target
+        // has a path no longer than its limit or the search runs out.
+        void RunWitnessSearch(VertexId source, VertexId excluded, Weight max_weight, size_t target_count) {
+            witness_search_.Reset();
+            witness_search_.Reach(source, ZERO_WEIGHT, NO_ARC);
+            size_t settled = 0;
+            while (!witness_search_.queue.empty() && settled < MAX_WITNESS_SETTLED) {
+                const QueueItem item = witness_search_.Pop();
+                if (item.weight > *witness_search_.weights[item.vertex]) {
+                    continue;
+                }
+                if (item.weight > max_weight) {
+                    break;
+                }
+                ++settled;
+                for (const size_t arc_id : out_arcs_[item.vertex]) {
+                    const Arc& arc = arcs_[arc_id];
+                    const Weight candidate_weight = item.weight + arc.weight;
+                    if (arc.to == excluded || candidate_weight > max_weight) {
+                        continue;
+                    }
+                    const auto& weight = witness_search_.weights[arc.to];
+                    if (weight && !(candidate_weight < *weight)) {
+                        continue;
+                    }
+                    witness_search_.Reach(arc.to, candidate_weight, arc_id);
+                    if (witness_targets_[arc.to] && !(witness_limits_[arc.to] < candidate_weight)) {
+                        witness_targets_[arc.to] = false;
+                        if (--target_count == 0) {
+                            return;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Edge difference plus the vertex level (one above its highest
+        // contracted neighbour), which keeps the hierarchy shallow.
+        long long ComputePriority(VertexId vertex, size_t shortcut_count) const {
+            const long long removed_arcs = static_cast<long long>(in_arcs_[vertex].size() + out_arcs_[vertex].size());
+            return static_cast<long long>(shortcut_count) - removed_arcs + levels_[vertex];
+        }
+
+        void Contract(VertexId vertex, const std::vector<Arc>& shortcuts) {
+            for (const Arc& shortcut : shortcuts) {
+                if (InsertArc(shortcut)) {
+                    ++shortcut_count_;
+                }
+            }
+            for (const size_t arc_id : in_arcs_[vertex]) {
+                const VertexId neighbour = arcs_[arc_id].from;
+                auto& neighbour_arcs = out_arcs_[neighbour];
+                neighbour_arcs.erase(std::find(neighbour_arcs.begin(), neighbour_arcs.end(), arc_id));
+                levels_[neighbour] = std::max(levels_[neighbour], levels_[vertex] + 1);
+            }
+            for (const size_t arc_id : out_arcs_[vertex]) {
+                const VertexId neighbour = arcs_[arc_id].to;
+                auto& neighbour_arcs = in_arcs_[neighbour];
+                neighbour_arcs.erase(std::find(neighbour_arcs.begin(), neighbour_arcs.end(), arc_id));
+                levels_[neighbour] = std::max(levels_[neighbour], levels_[vertex] + 1);
+            }
+            std::vector<size_t>().swap(in_arcs_[vertex]);
+            std::vector<size_t>().swap(out_arcs_[vertex]);
+            contracted_[vertex] = true;
+        }
+
+        void BuildSearchGraphs(const std::vector<size_t>& ranks) {
+            const size_t vertex_count = ranks.size();
+            up_offsets_.assign(vertex_count + 1, 0);
+            down_offsets_.assign(vertex_count + 1, 0);
+            for (size_t arc_id = 0; arc_id < arcs_.size(); ++arc_id) {
+                const Arc& arc = arcs_[arc_id];
+                if (!in_hierarchy_[arc_id]) {
+                    continue;
+                }
+                if (ranks[arc.from] < ranks[arc.to]) {
+                    ++up_offsets_[arc.from + 1];
+                } else {
+                    ++down_offsets_[arc.to + 1];
+                }
+            }
+            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+                up_offsets_[vertex + 1] += up_offsets_[vertex];
+                down_offsets_[vertex + 1] += down_offsets_[vertex];
+            }
+            up_arcs_.resize(up_offsets_.back());
+            down_arcs_.resize(down_offsets_.back());
+            std::vector<size_t> next_up(up_offsets_.begin(), up_offsets_.end() - 1);
+            std::vector<size_t> next_down(down_offsets_.begin(), down_offsets_.end() - 1);
+            for (size_t arc_id = 0; arc_id < arcs_.size(); ++arc_id) {
+                const Arc& arc = arcs_[arc_id];
+                if (!in_hierarchy_[arc_id]) {
+                    continue;
+                }
+                if (ranks[arc.from] < ranks[arc.to]) {
+                    up_arcs_[next_up[arc.from]++] = {arc.to, arc.weight, arc_id};
+                } else {
+                    down_arcs_[next_down[arc.to]++] = {arc.from, arc.weight, arc_id};
+                }
+            }
+        }
+
+        // Pops the closest vertex and relaxes its arcs unless it is stale or
+        // not below bound; returns whether it was settled.
+        static bool Expand(SearchSpace& search, const std::vector<SearchArc>& arcs,
+                           const std::vector<size_t>& offsets, Weight bound) {
+            const QueueItem item = search.Pop();
+            if (item.weight > *search.weights[item.vertex] || item.weight >= bound) {
+                return false;
+            }
+            for (size_t i = offsets[item.vertex]; i < offsets[item.vertex + 1]; ++i) {
+                const SearchArc& arc = arcs[i];
+                const Weight candidate_weight = item.weight + arc.weight;
+                const auto& weight = search.weights[arc.target];
+                if (!weight || candidate_weight < *weight) {
+                    search.Reach(arc.target, candidate_weight, arc.arc_id);
+                }
+            }
+            return true;
+        }
+
+        // Settles every vertex reachable from source over arcs and calls
+        // on_settled(vertex, weight) for each of them.
+        template <typename OnSettled>
+        void RunFullSearch(SearchSpace& search, const std::vector<SearchArc>& arcs,
+                           const std::vector<size_t>& offsets, VertexId source, OnSettled on_settled) const {
+            search.Reset();
+            search.Reach(source, ZERO_WEIGHT, NO_ARC);
+            ++stats_.search_count;
+            while (!search.queue.empty()) {
+                const QueueItem item = search.queue.front();
+                if (Expand(search, arcs, offsets, std::numeric_limits<Weight>::max())) {
+                    ++stats_.settled_vertex_count;
+                    on_settled(item.vertex, item.weight);
+                }
+            }
+        }
+
+        void CheckVertex(VertexId vertex) const {
+            if (vertex >= up_offsets_.size() - 1) {
+                throw std::out_of_range("Vertex id is out of range");
+            }
+        }
+
+        void UnpackArc(size_t arc_id, std::vector<EdgeId>& edges) const {
+            std::vector<size_t> stack{arc_id};
+            while (!stack.empty()) {
+                const Arc& arc = arcs_[stack.back()];
+                stack.pop_back();
+                if (arc.edge_id != NO_EDGE) {
+                    edges.push_back(arc.edge_id);
+                } else {
+                    stack.push_back(arc.second_half);
+                    stack.push_back(arc.first_half);
+                }
+            }
+        }
+
+        std::vector<Arc> arcs_;
+        std::vector<bool> in_hierarchy_;
+        size_t shortcut_count_ = 0;
+
+        // Contraction state, released once the hierarchy is built.
+        std::vector<std::vector<size_t>> out_arcs_;
+        std::vector<std::vector<size_t>> in_arcs_;
+        std::vector<bool> contracted_;
+        std::vector<bool> witness_targets_;
+        std::vector<Weight> witness_limits_;
+        std::vector<long long> levels_;
+        SearchSpace witness_search_;
+
+        std::vector<size_t> up_offsets_;
+        std::vector<SearchArc> up_arcs_;
+        std::vector<size_t> down_offsets_;
+        std::vector<SearchArc> down_arcs_;
+
+        mutable SearchSpace forward_search_;
+        mutable SearchSpace backward_search_;
+        mutable SearchStats stats_;
+    };
+
+    template <typename Weight>
+    ContractionHierarchy<Weight>::ContractionHierarchy(const Graph& graph)
+        : out_arcs_(graph.GetVertexCount())
+        , in_arcs_(graph.GetVertexCount())
+        , contracted_(graph.GetVertexCount(), false)
+        , witness_targets_(graph.GetVertexCount(), false)
+        , witness_limits_(graph.GetVertexCount())
+        , levels_(graph.GetVertexCount(), 0)
+        , witness_search_(graph.GetVertexCount())
+        , forward_search_(graph.GetVertexCount())
+        , backward_search_(graph.GetVertexCount())
+    {
+        const size_t vertex_count = graph.GetVertexCount();
+        for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+            const auto& edge = graph.GetEdge(edge_id);
+            if (edge.weight < ZERO_WEIGHT) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+            if (edge.from != edge.to) {
+                InsertArc({edge.from, edge.to, edge.weight, edge_id, NO_ARC, NO_ARC});
+            }
+        }
+
+        std::priority_queue<std::pair<long long, VertexId>, std::vector<std::pair<long long, VertexId>>,
+                            std::greater<>> order;
+        for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            // Every neighbour pair needing a shortcut is an upper bound; real
+            // values are computed lazily when the vertex reaches the top.
+            order.push({ComputePriority(vertex, in_arcs_[vertex].size() * out_arcs_[vertex].size()), vertex});
+        }
+
+        std::vector<size_t> ranks(vertex_count);
+        size_t next_rank = 0;
+        while (!order.empty()) {
+            const auto [priority, vertex] = order.top();
+            order.pop();
+            if (contracted_[vertex]) {
+                continue;
+            }
+            // Priorities go stale as neighbours get contracted; recheck lazily.
+            const std::vector<Arc> shortcuts = FindShortcuts(vertex);
+            const long long current_priority = ComputePriority(vertex, shortcuts.size());
+            if (!order.empty() && current_priority > order.top().first) {
+                order.push({current_priority, vertex});
+                continue;
+            }
+            Contract(vertex, shortcuts);
+            ranks[vertex] = next_rank++;
+        }
+
+        BuildSearchGraphs(ranks);
+
+        std::vector<std::vector<size_t>>().swap(out_arcs_);
+        std::vector<std::vector<size_t>>().swap(in_arcs_);
+        std::vector<bool>().swap(contracted_);
+        std::vector<bool>().swap(witness_targets_);
+        std::vector<Weight>().swap(witness_limits_);
+        std::vector<long long>().swap(levels_);
+        witness_search_ = SearchSpace{};
+    }
+
+    template <typename Weight>
+    std::optional<typename ContractionHierarchy<Weight>::RouteInfo>
+    ContractionHierarchy<Weight>::BuildRoute(VertexId from, VertexId to) const {
+        CheckVertex(from);
+        CheckVertex(to);
+        if (from == to) {
+            return RouteInfo{ZERO_WEIGHT, {}};
+        }
+
+        forward_search_.Reset();
+        backward_search_.Reset();
+        forward_search_.Reach(from, ZERO_WEIGHT, NO_ARC);
+        backward_search_.Reach(to, ZERO_WEIGHT, NO_ARC);
+        ++stats_.search_count;
+
+        std::optional<Weight> best_weight;
+        VertexId meeting_vertex = from;
+        auto try_meet = [&](VertexId vertex) {
+            if (forward_search_.weights[vertex] && backward_search_.weights[vertex]) {
+                const Weight weight = *forward_search_.weights[vertex] + *backward_search_.weights[vertex];
+                if (!best_weight || weight < *best_weight) {
+                    best_weight = weight;
+                    meeting_vertex = vertex;
+                }
+            }
+        };
+
+        while (!forward_search_.queue.empty() || !backward_search_.queue.empty()) {
+            const bool forward_done = forward_search_.queue.empty()
+                || (best_weight && forward_search_.queue.front().weight >= *best_weight);
+            const bool backward_done = backward_search_.queue.empty()
+                || (best_weight && backward_search_.queue.front().weight >= *best_weight);
+            if (forward_done && backward_done) {
+                break;
+            }
+            const Weight bound = best_weight ? *best_weight : std::numeric_limits<Weight>::max();
+            if (!forward_done && (backward_done
+                    || forward_search_.queue.front().weight <= backward_search_.queue.front().weight)) {
+                const VertexId vertex = forward_search_.queue.front().vertex;
+                if (Expand(forward_search_, up_arcs_, up_offsets_, bound)) {
+                    ++stats_.settled_vertex_count;
+                }
+                try_meet(vertex);
+            } else {
+                const VertexId vertex = backward_search_.queue.front().vertex;
+                if (Expand(backward_search_, down_arcs_, down_offsets_, bound)) {
+                    ++stats_.settled_vertex_count;
+                }
+                try_meet(vertex);
+            }
+        }
+
+        if (!best_weight) {
+            return std::nullopt;
+        }
+
+        std::vector<size_t> forward_arcs;
+        for (VertexId vertex = meeting_vertex; forward_search_.prev_arcs[vertex] != NO_ARC;
+             vertex = arcs_[forward_search_.prev_arcs[vertex]].from) {
+            forward_arcs.push_back(forward_search_.prev_arcs[vertex]);
+        }
+        std::vector<EdgeId> edges;
+        for (auto it = forward_arcs.rbegin(); it != forward_arcs.rend(); ++it) {
+            UnpackArc(*it, edges);
+        }
+        for (VertexId vertex = meeting_vertex; backward_search_.prev_arcs[vertex] != NO_ARC;
+             vertex = arcs_[backward_search_.prev_arcs[vertex]].to) {
+            UnpackArc(backward_search_.prev_arcs[vertex], edges);
+        }
+
+        return RouteInfo{*best_weight, std::move(edges)};
+    }
+
+    template <typename Weight>
+    void ContractionHierarchy<Weight>::ComputeWeights(
+            const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+            const std::function<void(size_t, const typename RouteEngine<Weight>::WeightRow&)>& on_row) const {
+        for (const auto* vertices : {&sources, &targets}) {
+            for (const VertexId vertex : *vertices) {
+                CheckVertex(vertex);
+            }
+        }
+
+        struct BucketEntry {
+            size_t target_index;
+            Weight weight;
+        };
+        std::vector<std::vector<BucketEntry>> buckets(up_offsets_.size() - 1);
+        for (size_t j = 0; j < targets.size(); ++j) {
+            RunFullSearch(backward_search_, down_arcs_, down_offsets_, targets[j], [&](VertexId vertex, Weight weight) {
+                buckets[vertex].push_back({j, weight});
+            });
+        }
+
+        typename RouteEngine<Weight>::WeightRow row(targets.size());
+        for (size_t i = 0; i < sources.size(); ++i) {
+            std::fill(row.begin(), row.end(), std::nullopt);
+            RunFullSearch(forward_search_, up_arcs_, up_offsets_, sources[i], [&](VertexId vertex, Weight weight) {
+                for (const BucketEntry& entry : buckets[vertex]) {
+                    auto& best_weight = row[entry.target_index];
+                    if (!best_weight || weight + entry.weight < *best_weight) {
+                        best_weight = weight + entry.weight;
+                    }
+                }
+            });
+            on_row(i, row);
+        }
+    }
+
+}
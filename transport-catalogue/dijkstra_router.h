@@ -0,0 +1,290 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace graph {
+
+    // Answers every query with a binary-heap Dijkstra instead of precomputing
+    // all pairs: construction is O(V + E), a query is O(E log V).
+    // Expects a frozen graph. Scratch buffers are reused between queries, so
+    // BuildRoute must not be called concurrently on the same instance.
+    template <typename Weight>
+    class DijkstraRouter : public RouteEngine<Weight> {
+    private:
+        using Graph = DirectedWeightedGraph<Weight>;
+
+    public:
+        explicit DijkstraRouter(const Graph& graph);
+
+        using RouteInfo = graph::RouteInfo<Weight>;
+
+        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const override;
+        // Runs a single search that stops once every target is settled.
+        std::vector<std::optional<RouteInfo>> BuildRoutes(VertexId from,
+                                                          const std::vector<VertexId>& targets) const override;
+        // Runs one such search per source.
+        void ComputeWeights(const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+                            const std::function<void(size_t, const typename RouteEngine<Weight>::WeightRow&)>& on_row)
+            const override;
+
+        SearchStats GetSearchStats() const override {
+            return stats_;
+        }
+
+        // Searches read the graph directly, so only the new weights are checked.
+        bool ApplyAddedEdges(EdgeId first_edge) override {
+            if (graph_.GetVertexCount() != weights_.size()) {
+                return false;
+            }
+            for (EdgeId edge_id = first_edge; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+                if (graph_.GetEdge(edge_id).weight < ZERO_WEIGHT) {
+                    throw std::domain_error("Edges' weights should be non-negative");
+                }
+            }
+            return true;
+        }
+
+    private:
+        struct QueueItem {
+            Weight weight;
+            VertexId vertex;
+
+            bool operator>(const QueueItem& other) const {
+                return weight > other.weight;
+            }
+        };
+
+        void ResetScratch() const {
+            for (const VertexId vertex : touched_vertices_) {
+                weights_[vertex].reset();
+                prev_edges_[vertex].reset();
+            }
+            touched_vertices_.clear();
+            queue_.clear();
+        }
+
+        void Reach(VertexId vertex, Weight weight, std::optional<EdgeId> prev_edge) const {
+            if (!weights_[vertex]) {
+                touched_vertices_.push_back(vertex);
+            }
+            weights_[vertex] = weight;
+            prev_edges_[vertex] = prev_edge;
+            queue_.push_back({weight, vertex});
+            std::push_heap(queue_.begin(), queue_.end(), std::greater<QueueItem>{});
+        }
+
+        // Settles vertices in order of distance from source until is_done
+        // returns true for a settled vertex or the queue runs out.
+        template <typename IsDone>
+        void Search(VertexId from, IsDone is_done) const;
+
+        // Search that stops once every target is settled.
+        void SearchTargets(VertexId from, const std::vector<VertexId>& targets) const;
+
+        std::optional<RouteInfo> ExtractRoute(VertexId to) const;
+
+        void CheckVertex(VertexId vertex) const {
+            if (vertex >= graph_.GetVertexCount()) {
+                throw std::out_of_range("Vertex id is out of range");
+            }
+        }
+
+        static constexpr Weight ZERO_WEIGHT{};
+        const Graph& graph_;
+
+        mutable std::vector<std::optional<Weight>> weights_;
+        mutable std::vector<std::optional<EdgeId>> prev_edges_;
+        mutable std::vector<VertexId> touched_vertices_;
+        mutable std::vector<QueueItem> queue_;
+        mutable std::vector<bool> pending_targets_;
+        mutable SearchStats stats_;
+    };
+
+    template <typename Weight>
+    DijkstraRouter<Weight>::DijkstraRouter(const Graph& graph)
+        : graph_(graph)
+        , weights_(graph.GetVertexCount())
+        , prev_edges_(graph.GetVertexCount())
+        , pending_targets_(graph.GetVertexCount(), false)
+    {
+        if (!graph.IsFrozen()) {
+            throw std::logic_error("Graph should be frozen before building a router");
+        }
+        for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+            if (graph.GetEdge(edge_id).weight < ZERO_WEIGHT) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+        }
+    }
+
+    template <typename Weight>
+    template <typename IsDone>
+    void DijkstraRouter<Weight>::Search(VertexId from, IsDone is_done) const {
+        ResetScratch();
+        Reach(from, ZERO_WEIGHT, std::nullopt);
+        ++stats_.search_count;
+
+        while (!queue_.empty()) {
+            std::pop_heap(queue_.begin(), queue_.end(), std::greater<QueueItem>{});
+            const QueueItem item = queue_.back();
+            queue_.pop_back();
+
+            if (item.weight > *weights_[item.vertex]) {
+                continue;
+            }
+            ++stats_.settled_vertex_count;
+            if (is_done(item.vertex)) {
+                break;
+            }
+            const IncidentArcs<Weight> arcs = graph_.GetIncidentArcs(item.vertex);
+            for (size_t i = 0; i < arcs.size; ++i) {
+                const VertexId target = arcs.targets[i];
+                const Weight candidate_weight = item.weight + arcs.weights[i];
+                if (!weights_[target] || candidate_weight < *weights_[target]) {
+                    Reach(target, candidate_weight, arcs.edge_ids[i]);
+                }
+            }
+        }
+    }
+
+    template <typename Weight>
+    std::optional<typename DijkstraRouter<Weight>::RouteInfo> DijkstraRouter<Weight>::ExtractRoute(VertexId to) const {
+        if (!weights_[to]) {
+            return std::nullopt;
+        }
+
+        std::vector<EdgeId> edges;
+        for (std::optional<EdgeId> edge_id = prev_edges_[to];
+            edge_id;
+            edge_id = prev_edges_[graph_.GetEdge(*edge_id).from])
+        {
+            edges.push_back(*edge_id);
+        }
+        std::reverse(edges.begin(), edges.end());
+
+        return RouteInfo{*weights_[to], std::move(edges)};
+    }
+
+    template <typename Weight>
+    std::optional<typename DijkstraRouter<Weight>::RouteInfo> DijkstraRouter<Weight>::BuildRoute(VertexId from,
+                                                                                                VertexId to) const {
+        CheckVertex(from);
+        CheckVertex(to);
+        Search(from, [to](VertexId vertex) {
+            return vertex == to;
+        });
+        return ExtractRoute(to);
+    }
+
+    template <typename Weight>
+    void DijkstraRouter<Weight>::SearchTargets(VertexId from, const std::vector<VertexId>& targets) const {
+        size_t pending_count = 0;
+        for (const VertexId to : targets) {
+            if (!pending_targets_[to]) {
+                pending_targets_[to] = true;
+                ++pending_count;
+            }
+        }
+
+        if (pending_count > 0) {
+            Search(from, [this, &pending_count](VertexId vertex) {
+                if (!pending_targets_[vertex]) {
+                    return false;
+                }
+                pending_targets_[vertex] = false;
+                return --pending_count == 0;
+            });
+        }
+        // Targets that are unreachable stay marked.
+        for (const VertexId to : targets) {
+            pending_targets_[to] = false;
+        }
+    }
+
+    template <typename Weight>
+    std::vector<std::optional<typename DijkstraRouter<Weight>::RouteInfo>>
+    DijkstraRouter<Weight>::BuildRoutes(VertexId from, const std::vector<VertexId>& targets) const {
+        CheckVertex(from);
+        for (const VertexId to : targets) {
+            CheckVertex(to);
+        }
+        SearchTargets(from, targets);
+
+        std::vector<std::optional<RouteInfo>> routes;
+        routes.reserve(targets.size());
+        for (const VertexId to : targets) {
+            routes.push_back(ExtractRoute(to));
+        }
+        return routes;
+    }
+
+    template <typename Weight>
+    void DijkstraRouter<Weight>::ComputeWeights(
+            const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+            const std::function<void(size_t, const typename RouteEngine<Weight>::WeightRow&)>& on_row) const {
+        for (const auto* vertices : {&sources, &targets}) {
+            for (const VertexId vertex : *vertices) {
+                CheckVertex(vertex);
+            }
+        }
+        typename RouteEngine<Weight>::WeightRow row(targets.size());
+        for (size_t i = 0; i < sources.size(); ++i) {
+            SearchTargets(sources[i], targets);
+            for (size_t j = 0; j < targets.size(); ++j) {
+                row[j] = weights_[targets[j]];
+            }
+            on_row(i, row);
+        }
+    }
+
+    // Every vertex whose distance from source is at most max_weight, with
+    // that distance, in order of distance. Costs one Dijkstra that stops at
+    // the first vertex beyond max_weight. Expects a frozen graph.
+    template <typename Weight>
+    std::vector<std::pair<VertexId, Weight>> FindReachableVertices(const DirectedWeightedGraph<Weight>& graph,
+                                                                   VertexId from, Weight max_weight) {
+        if (from >= graph.GetVertexCount()) {
+            throw std::out_of_range("Vertex id is out of range");
+        }
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::vector<std::optional<Weight>> weights(graph.GetVertexCount());
+        std::vector<QueueItem> queue;
+        std::vector<std::pair<VertexId, Weight>> reachable;
+
+        weights[from] = Weight{};
+        queue.push_back({Weight{}, from});
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+            const auto [weight, vertex] = queue.back();
+            queue.pop_back();
+
+            if (weight > *weights[vertex]) {
+                continue;
+            }
+            if (max_weight < weight) {
+                break;
+            }
+            reachable.emplace_back(vertex, weight);
+            const IncidentArcs<Weight> arcs = graph.GetIncidentArcs(vertex);
+            for (size_t i = 0; i < arcs.size; ++i) {
+                const VertexId target = arcs.targets[i];
+                const Weight candidate_weight = weight + arcs.weights[i];
+                if (!(max_weight < candidate_weight) && (!weights[target] || candidate_weight < *weights[target])) {
+                    weights[target] = candidate_weight;
+                    queue.push_back({candidate_weight, target});
+                    std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+                }
+            }
+        }
+        return reachable;
+    }
+
+}
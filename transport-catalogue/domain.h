@@ -1,23 +1,45 @@
 #pragma once
 #include "geo.h"
+#include "ranges.h"
 
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// Dense ids, assigned by the catalogue in order of insertion.
+using StopId = uint32_t;
+using BusId = uint32_t;
+
+// Stands for a stop missing from the catalogue in Bus::stop_ids.
+inline constexpr StopId NO_STOP = std::numeric_limits<StopId>::max();
+
+// Names and routes are allocated from the arena of the catalogue that
+// holds the object.
 struct Stop {
-    std::string name;
+    std::pmr::string name;
     geo::Coordinates coord;
+    StopId id = 0;
 };
 
 struct Bus {
-    std::string name;
-    std::vector<const Stop*> route;
+    std::pmr::string name;
+    std::pmr::vector<const Stop*> route;
     bool is_round_trip = false;
+    BusId id = 0;
+    // Ids of route, filled in by the catalogue.
+    std::pmr::vector<StopId> stop_ids{};
 };
 
+using BusRange = ranges::Range<const Bus* const*>;
+
+// Views into the catalogue, valid while it is not modified.
 struct StopInfo {
-    std::string name;
-    std::vector<const Bus*> buses;
+    std::string_view name;
+    // Ordered by bus name.
+    BusRange buses;
 };
 
 struct BusInfo {
@@ -3,6 +3,8 @@
 #include "ranges.h"
 
 #include <cstdlib>
+#include <optional>
+#include <stdexcept>
 #include <vector>
 
 namespace graph {
@@ -17,43 +19,176 @@ namespace graph {
         Weight weight;
     };
 
+    // Outgoing arcs of one vertex in a frozen graph, stored as parallel arrays.
+    template <typename Weight>
+    struct IncidentArcs {
+        const EdgeId* edge_ids;
+        const VertexId* targets;
+        const Weight* weights;
+        size_t size;
+    };
+
     template <typename Weight>
     class DirectedWeightedGraph {
     private:
         using IncidenceList = std::vector<EdgeId>;
-        using IncidentEdgesRange = ranges::Range<typename IncidenceList::const_iterator>;
+        using IncidentEdgesRange = ranges::Range<const EdgeId*>;
 
     public:
         DirectedWeightedGraph() = default;
         explicit DirectedWeightedGraph(size_t vertex_count);
         EdgeId AddEdge(const Edge<Weight>& edge);
 
+        // Packs the incidence lists into compressed sparse row arrays and
+        // releases them. Adding an edge to a frozen graph unpacks it again.
+        void Freeze();
+        bool IsFrozen() const;
+        // Drops every edge that has a parallel edge (same ends) added before it
+        // with a weight that is not greater, so routers still pick the same
+        // edges. Remaining edges keep their relative order and are renumbered;
+        // returns the former id of each.
+        std::vector<EdgeId> RemoveDominatedEdges();
+
         size_t GetVertexCount() const;
         size_t GetEdgeCount() const;
         const Edge<Weight>& GetEdge(EdgeId edge_id) const;
         IncidentEdgesRange GetIncidentEdges(VertexId vertex) const;
+        IncidentArcs<Weight> GetIncidentArcs(VertexId vertex) const;
 
     private:
+        void Thaw();
+
+        size_t vertex_count_ = 0;
         std::vector<Edge<Weight>> edges_;
         std::vector<IncidenceList> incidence_lists_;
+
+        bool frozen_ = false;
+        std::vector<size_t> arc_offsets_;
+        std::vector<EdgeId> arc_edge_ids_;
+        std::vector<VertexId> arc_targets_;
+        std::vector<Weight> arc_weights_;
     };
 
     template <typename Weight>
     DirectedWeightedGraph<Weight>::DirectedWeightedGraph(size_t vertex_count)
-        : incidence_lists_(vertex_count) {
+        : vertex_count_(vertex_count)
+        , incidence_lists_(vertex_count) {
     }
 
     template <typename Weight>
     EdgeId DirectedWeightedGraph<Weight>::AddEdge(const Edge<Weight>& edge) {
+        if (edge.from >= vertex_count_ || edge.to >= vertex_count_) {
+            throw std::out_of_range("Edge endpoint is out of range");
+        }
+        if (frozen_) {
+            Thaw();
+        }
         edges_.push_back(edge);
         const EdgeId id = edges_.size() - 1;
-        incidence_lists_.at(edge.from).push_back(id);
+        incidence_lists_[edge.from].push_back(id);
         return id;
     }
 
+    template <typename Weight>
+    void DirectedWeightedGraph<Weight>::Freeze() {
+        if (frozen_) {
+            return;
+        }
+        // Counting sort by source vertex; edges of one vertex keep their
+        // insertion order, so routers break ties exactly as before.
+        arc_offsets_.assign(vertex_count_ + 1, 0);
+        for (const auto& edge : edges_) {
+            ++arc_offsets_[edge.from + 1];
+        }
+        for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+            arc_offsets_[vertex + 1] += arc_offsets_[vertex];
+        }
+
+        arc_edge_ids_.resize(edges_.size());
+        arc_targets_.resize(edges_.size());
+        arc_weights_.resize(edges_.size());
+        std::vector<size_t> next_arc(arc_offsets_.begin(), arc_offsets_.end() - 1);
+        for (EdgeId edge_id = 0; edge_id < edges_.size(); ++edge_id) {
+            const auto& edge = edges_[edge_id];
+            const size_t arc = next_arc[edge.from]++;
+            arc_edge_ids_[arc] = edge_id;
+            arc_targets_[arc] = edge.to;
+            arc_weights_[arc] = edge.weight;
+        }
+
+        std::vector<IncidenceList>().swap(incidence_lists_);
+        frozen_ = true;
+    }
+
+    template <typename Weight>
+    void DirectedWeightedGraph<Weight>::Thaw() {
+        incidence_lists_.assign(vertex_count_, {});
+        for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+            incidence_lists_[vertex].assign(arc_edge_ids_.begin() + arc_offsets_[vertex],
+                                            arc_edge_ids_.begin() + arc_offsets_[vertex + 1]);
+        }
+        std::vector<size_t>().swap(arc_offsets_);
+        std::vector<EdgeId>().swap(arc_edge_ids_);
+        std::vector<VertexId>().swap(arc_targets_);
+        std::vector<Weight>().swap(arc_weights_);
+        frozen_ = false;
+    }
+
+    template <typename Weight>
+    std::vector<EdgeId> DirectedWeightedGraph<Weight>::RemoveDominatedEdges() {
+        const bool was_frozen = frozen_;
+        if (frozen_) {
+            Thaw();
+        }
+
+        // Incidence lists are in insertion order, so a strict comparison keeps
+        // the first of equally heavy edges.
+        std::vector<bool> is_kept(edges_.size(), false);
+        std::vector<std::optional<EdgeId>> best_edges(vertex_count_);
+        for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+            for (const EdgeId edge_id : incidence_lists_[vertex]) {
+                auto& best_edge = best_edges[edges_[edge_id].to];
+                if (!best_edge || edges_[edge_id].weight < edges_[*best_edge].weight) {
+                    best_edge = edge_id;
+                }
+            }
+            for (const EdgeId edge_id : incidence_lists_[vertex]) {
+                auto& best_edge = best_edges[edges_[edge_id].to];
+                if (best_edge) {
+                    is_kept[*best_edge] = true;
+                    best_edge.reset();
+                }
+            }
+        }
+
+        std::vector<EdgeId> kept_edge_ids;
+        std::vector<Edge<Weight>> kept_edges;
+        for (EdgeId edge_id = 0; edge_id < edges_.size(); ++edge_id) {
+            if (is_kept[edge_id]) {
+                kept_edge_ids.push_back(edge_id);
+                kept_edges.push_back(edges_[edge_id]);
+            }
+        }
+        edges_ = std::move(kept_edges);
+        incidence_lists_.assign(vertex_count_, {});
+        for (EdgeId edge_id = 0; edge_id < edges_.size(); ++edge_id) {
+            incidence_lists_[edges_[edge_id].from].push_back(edge_id);
+        }
+
+        if (was_frozen) {
+            Freeze();
+        }
+        return kept_edge_ids;
+    }
+
+    template <typename Weight>
+    bool DirectedWeightedGraph<Weight>::IsFrozen() const {
+        return frozen_;
+    }
+
     template <typename Weight>
     size_t DirectedWeightedGraph<Weight>::GetVertexCount() const {
-        return incidence_lists_.size();
+        return vertex_count_;
     }
 
     template <typename Weight>
@@ -69,6 +204,21 @@ namespace graph {
     template <typename Weight>
     typename DirectedWeightedGraph<Weight>::IncidentEdgesRange
     DirectedWeightedGraph<Weight>::GetIncidentEdges(VertexId vertex) const {
-        return ranges::AsRange(incidence_lists_.at(vertex));
+        if (frozen_) {
+            const EdgeId* arcs = arc_edge_ids_.data();
+            return {arcs + arc_offsets_.at(vertex), arcs + arc_offsets_.at(vertex + 1)};
+        }
+        const auto& incidence_list = incidence_lists_.at(vertex);
+        return {incidence_list.data(), incidence_list.data() + incidence_list.size()};
+    }
+
+    template <typename Weight>
+    IncidentArcs<Weight> DirectedWeightedGraph<Weight>::GetIncidentArcs(VertexId vertex) const {
+        if (!frozen_) {
+            throw std::logic_error("Graph should be frozen to iterate arcs");
+        }
+        const size_t first = arc_offsets_[vertex];
+        return {arc_edge_ids_.data() + first, arc_targets_.data() + first, arc_weights_.data() + first,
+                arc_offsets_[vertex + 1] - first};
     }
 }
\ No newline at end of file
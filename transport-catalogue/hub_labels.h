@@ -0,0 +1,292 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace graph {
+
+    // Hub labels of every vertex in one direction, flattened: the label of
+    // vertex v is hubs/weights[offsets[v]..offsets[v + 1]), sorted by hub.
+    // Hubs are ranks rather than vertex ids, so labels merge in rank order.
+    template <typename Weight>
+    struct LabelSet {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> hubs;
+        std::vector<Weight> weights;
+
+        bool IsValid(size_t vertex_count) const {
+            if (offsets.size() != vertex_count + 1 || offsets.front() != 0 || offsets.back() != hubs.size()
+                || hubs.size() != weights.size()) {
+                return false;
+            }
+            for (size_t vertex = 0; vertex < vertex_count; ++vertex) {
+                if (offsets[vertex] > offsets[vertex + 1]) {
+                    return false;
+                }
+                for (uint32_t i = offsets[vertex]; i < offsets[vertex + 1]; ++i) {
+                    if (hubs[i] >= vertex_count || (i > offsets[vertex] && hubs[i - 1] >= hubs[i])) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+    };
+
+    // Distance oracle by pruned landmark labeling: every vertex keeps the
+    // distances to (out-label) and from (in-label) a few hub vertices, such
+    // that each shortest route passes through a hub common to both ends.
+    // A query is one merge of two sorted labels; no route is produced.
+    // Construction runs a forward and a backward Dijkstra from every vertex,
+    // most connected first, each cut short wherever the labels found so far
+    // already give the distance. Queries keep no state and may run
+    // concurrently.
+    template <typename Weight>
+    class HubLabels {
+    public:
+        using Labels = LabelSet<Weight>;
+
+        explicit HubLabels(const DirectedWeightedGraph<Weight>& graph);
+        // Takes labels built earlier, for example loaded from a snapshot.
+        HubLabels(Labels out_labels, Labels in_labels);
+
+        std::optional<Weight> ComputeWeight(VertexId from, VertexId to) const;
+
+        size_t GetVertexCount() const {
+            return out_labels_.offsets.size() - 1;
+        }
+
+        size_t GetEntryCount() const {
+            return out_labels_.hubs.size() + in_labels_.hubs.size();
+        }
+
+        const Labels& GetOutLabels() const {
+            return out_labels_;
+        }
+
+        const Labels& GetInLabels() const {
+            return in_labels_;
+        }
+
+    private:
+        static constexpr Weight ZERO_WEIGHT{};
+        static constexpr Weight INFINITE_WEIGHT = std::numeric_limits<Weight>::max();
+
+        using Entry = std::pair<uint32_t, Weight>;
+
+        // Arcs of one search direction in CSR form.
+        struct Arcs {
+            std::vector<size_t> offsets;
+            std::vector<VertexId> targets;
+            std::vector<Weight> weights;
+        };
+
+        struct Scratch {
+            std::vector<Weight> distances;
+            std::vector<VertexId> touched;
+            // Distances between the search source and each hub rank.
+            std::vector<Weight> hub_distances;
+        };
+
+        static Arcs MakeArcs(const DirectedWeightedGraph<Weight>& graph, bool reverse);
+        // Adds hub rank to the labels of every vertex whose distance from (or
+        // to, on reverse arcs) source the current labels do not cover yet.
+        static void RunPrunedSearch(VertexId source, uint32_t rank, const Arcs& arcs,
+                                    const std::vector<Entry>& source_label, std::vector<std::vector<Entry>>& labels,
+                                    Scratch& scratch);
+        static Labels Flatten(const std::vector<std::vector<Entry>>& labels);
+
+        Labels out_labels_;
+        Labels in_labels_;
+    };
+
+    template <typename Weight>
+    HubLabels<Weight>::HubLabels(const DirectedWeightedGraph<Weight>& graph) {
+        const size_t vertex_count = graph.GetVertexCount();
+        if (vertex_count >= std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("Too many vertices for hub labels");
+        }
+        for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+            if (graph.GetEdge(edge_id).weight < ZERO_WEIGHT) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+        }
+
+        const Arcs forward_arcs = MakeArcs(graph, false);
+        const Arcs backward_arcs = MakeArcs(graph, true);
+
+        // Well-connected vertices lie on many routes, so they go first and
+        // prune the searches of all others.
+        std::vector<VertexId> order(vertex_count);
+        std::iota(order.begin(), order.end(), VertexId{0});
+        auto get_degree = [&](VertexId vertex) {
+            return forward_arcs.offsets[vertex + 1] - forward_arcs.offsets[vertex]
+                   + backward_arcs.offsets[vertex + 1] - backward_arcs.offsets[vertex];
+        };
+        std::stable_sort(order.begin(), order.end(), [&](VertexId lhs, VertexId rhs) {
+            return get_degree(lhs) > get_degree(rhs);
+        });
+
+        std::vector<std::vector<Entry>> out_labels(vertex_count);
+        std::vector<std::vector<Entry>> in_labels(vertex_count);
+        Scratch scratch{std::vector<Weight>(vertex_count, INFINITE_WEIGHT), {},
+                        std::vector<Weight>(vertex_count, INFINITE_WEIGHT)};
+        for (uint32_t rank = 0; rank < vertex_count; ++rank) {
+            const VertexId vertex = order[rank];
+            RunPrunedSearch(vertex, rank, forward_arcs, out_labels[vertex], in_labels, scratch);
+            RunPrunedSearch(vertex, rank, backward_arcs, in_labels[vertex], out_labels, scratch);
+        }
+
+        out_labels_ = Flatten(out_labels);
+        in_labels_ = Flatten(in_labels);
+    }
+
+    template <typename Weight>
+    HubLabels<Weight>::HubLabels(Labels out_labels, Labels in_labels)
+        : out_labels_(std::move(out_labels))
+        , in_labels_(std::move(in_labels)) {
+        const size_t vertex_count = out_labels_.offsets.empty() ? 0 : out_labels_.offsets.size() - 1;
+        if (!out_labels_.IsValid(vertex_count) || !in_labels_.IsValid(vertex_count)) {
+            throw std::invalid_argument("Malformed hub labels");
+        }
+    }
+
+    template <typename Weight>
+    typename HubLabels<Weight>::Arcs HubLabels<Weight>::MakeArcs(const DirectedWeightedGraph<Weight>& graph,
+                                                                 bool reverse) {
+        const size_t vertex_count = graph.GetVertexCount();
+        const size_t edge_count = graph.GetEdgeCount();
+        Arcs arcs;
+        arcs.offsets.assign(vertex_count + 1, 0);
+        for (EdgeId edge_id = 0; edge_id < edge_count; ++edge_id) {
+            const auto& edge = graph.GetEdge(edge_id);
+            ++arcs.offsets[(reverse ? edge.to : edge.from) + 1];
+        }
+        for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            arcs.offsets[vertex + 1] += arcs.offsets[vertex];
+        }
+        arcs.targets.resize(edge_count);
+        arcs.weights.resize(edge_count);
+        std::vector<size_t> next_arc(arcs.offsets.begin(), arcs.offsets.end() - 1);
+        for (EdgeId edge_id = 0; edge_id < edge_count; ++edge_id) {
+            const auto& edge = graph.GetEdge(edge_id);
+            const size_t arc = next_arc[reverse ? edge.to : edge.from]++;
+            arcs.targets[arc] = reverse ? edge.from : edge.to;
+            arcs.weights[arc] = edge.weight;
+        }
+        return arcs;
+    }
+
+    template <typename Weight>
+    void HubLabels<Weight>::RunPrunedSearch(VertexId source, uint32_t rank, const Arcs& arcs,
+                                            const std::vector<Entry>& source_label,
+                                            std::vector<std::vector<Entry>>& labels, Scratch& scratch) {
+        for (const auto& [hub, weight] : source_label) {
+            scratch.hub_distances[hub] = weight;
+        }
+        auto is_covered = [&](VertexId vertex, Weight weight) {
+            for (const auto& [hub, hub_weight] : labels[vertex]) {
+                if (scratch.hub_distances[hub] != INFINITE_WEIGHT && scratch.hub_distances[hub] + hub_weight <= weight) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::vector<QueueItem> queue;
+        scratch.distances[source] = ZERO_WEIGHT;
+        scratch.touched.push_back(source);
+        queue.push_back({ZERO_WEIGHT, source});
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+            const auto [weight, vertex] = queue.back();
+            queue.pop_back();
+            if (weight > scratch.distances[vertex] || is_covered(vertex, weight)) {
+                continue;
+            }
+            labels[vertex].push_back({rank, weight});
+            for (size_t arc = arcs.offsets[vertex]; arc < arcs.offsets[vertex + 1]; ++arc) {
+                const VertexId target = arcs.targets[arc];
+                const Weight candidate_weight = weight + arcs.weights[arc];
+                if (candidate_weight < scratch.distances[target]) {
+                    if (scratch.distances[target] == INFINITE_WEIGHT) {
+                        scratch.touched.push_back(target);
+                    }
+                    scratch.distances[target] = candidate_weight;
+                    queue.push_back({candidate_weight, target});
+                    std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+                }
+            }
+        }
+
+        for (const VertexId vertex : scratch.touched) {
+            scratch.distances[vertex] = INFINITE_WEIGHT;
+        }
+        scratch.touched.clear();
+        for (const auto& [hub, weight] : source_label) {
+            scratch.hub_distances[hub] = INFINITE_WEIGHT;
+        }
+    }
+
+    template <typename Weight>
+    LabelSet<Weight> HubLabels<Weight>::Flatten(const std::vector<std::vector<Entry>>& labels) {
+        Labels result;
+        result.offsets.reserve(labels.size() + 1);
+        result.offsets.push_back(0);
+        size_t entry_count = 0;
+        for (const auto& label : labels) {
+            entry_count += label.size();
+            if (entry_count > std::numeric_limits<uint32_t>::max()) {
+                throw std::length_error("Too many hub label entries");
+            }
+            result.offsets.push_back(static_cast<uint32_t>(entry_count));
+        }
+        result.hubs.reserve(entry_count);
+        result.weights.reserve(entry_count);
+        for (const auto& label : labels) {
+            for (const auto& [hub, weight] : label) {
+                result.hubs.push_back(hub);
+                result.weights.push_back(weight);
+            }
+        }
+        return result;
+    }
+
+    template <typename Weight>
+    std::optional<Weight> HubLabels<Weight>::ComputeWeight(VertexId from, VertexId to) const {
+        if (from >= GetVertexCount() || to >= GetVertexCount()) {
+            throw std::out_of_range("Vertex id is out of range");
+        }
+        uint32_t i = out_labels_.offsets[from];
+        const uint32_t i_end = out_labels_.offsets[from + 1];
+        uint32_t j = in_labels_.offsets[to];
+        const uint32_t j_end = in_labels_.offsets[to + 1];
+
+        Weight best = INFINITE_WEIGHT;
+        while (i < i_end && j < j_end) {
+            const uint32_t out_hub = out_labels_.hubs[i];
+            const uint32_t in_hub = in_labels_.hubs[j];
+            if (out_hub < in_hub) {
+                ++i;
+            } else if (in_hub < out_hub) {
+                ++j;
+            } else {
+                best = std::min(best, out_labels_.weights[i] + in_labels_.weights[j]);
+                ++i;
+                ++j;
+            }
+        }
+        return best == INFINITE_WEIGHT ? std::nullopt : std::optional<Weight>(best);
+    }
+
+}
@@ -2,13 +2,35 @@
 #include "json_builder.h"
 #include "transport_router.h"
 
+#include <memory>
 #include <sstream>
 #include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 using namespace std;
 
 namespace jsonreader {
+    // routing_settings.thread_count, which bounds both the threads freezing
+    // the catalogue and those of the all-pairs precompute; 1 when not set.
+    size_t GetThreadCount(const json::Dict& root) {
+        if (!root.count("routing_settings")) {
+            return 1;
+        }
+        const auto& rs = root.at("routing_settings").AsMap();
+        if (!rs.count("thread_count")) {
+            return 1;
+        }
+        const int thread_count = rs.at("thread_count").AsInt();
+        if (thread_count < 1) {
+            throw invalid_argument("thread_count should be positive");
+        }
+        return static_cast<size_t>(thread_count);
+    }
+
     json::Document JsonReader::ReadData(std::istream& input) {
         document_json_ = json::Load(input);
         return document_json_;
@@ -22,10 +44,9 @@ namespace jsonreader {
         for (const auto& item : arr) {
             const json::Dict& cmd = item.AsMap();
             if (cmd.at("type").AsString() == "Stop") {
-                std::string name = cmd.at("name").AsString();
                 double lat = cmd.at("latitude").AsDouble();
                 double lng = cmd.at("longitude").AsDouble();
-                tc.AddStop({ std::move(name), { lat, lng } });
+                tc.AddStop(cmd.at("name").AsString(), { lat, lng });
             }
         }
 
@@ -42,12 +63,13 @@ namespace jsonreader {
             }
         }
 
+        // The catalogue copies routes into its arena, so one buffer serves all.
+        vector<const Stop*> route;
         for (const auto& item : arr) {
             const json::Dict& cmd = item.AsMap();
             if (cmd.at("type").AsString() == "Bus") {
-                std::string name = cmd.at("name").AsString();
                 bool is_round = cmd.at("is_roundtrip").AsBool();
-                vector<const Stop*> route;
+                route.clear();
                 for (const auto& s : cmd.at("stops").AsArray()) {
                     const Stop* st = tc.FindStop(s.AsString());
                     route.push_back(st);
@@ -57,9 +79,10 @@ namespace jsonreader {
                         route.push_back(route[i]);
                     }
                 }
-                tc.AddBus({ std::move(name), std::move(route), is_round });
+                tc.AddBus(cmd.at("name").AsString(), route, is_round);
             }
         }
+        tc.Freeze(GetThreadCount(root));
     }
 
     svg::Color JsonReader::GetJsonColor(const json::Node& color) const {
@@ -139,19 +162,11 @@ namespace jsonreader {
                 .EndDict()
                 .Build();
         }
-        const auto& si = stop_info_opt.value();
-        std::vector<std::string> bus_names;
-        bus_names.reserve(si.buses.size());
-        for (const auto* b : si.buses) {
-            if (b) bus_names.push_back(b->name);
-        }
-        std::sort(bus_names.begin(), bus_names.end());
-        
         json::Builder builder;
         builder.StartDict()
                .Key("buses").StartArray();
-        for (auto& bn : bus_names) {
-            builder.Value(std::move(bn));
+        for (const auto* bus : stop_info_opt->buses) {
+            builder.Value(std::string(bus->name));
         }
         return builder.EndArray()
                       .Key("request_id").Value(id)
@@ -160,8 +175,8 @@ namespace jsonreader {
     }
 
     json::Node ProcessBusRequest(int id, const std::string& name, const transport_catalogue::TransportCatalogue& tc) {
-        auto bus_info_opt = tc.GetBusInfo(name);
-        if (!bus_info_opt.has_value()) {
+        const BusInfo* bus_info = tc.GetBusInfo(name);
+        if (!bus_info) {
             return json::Builder{}
                 .StartDict()
                     .Key("request_id").Value(id)
@@ -170,7 +185,7 @@ namespace jsonreader {
                 .Build();
         }
 
-        const auto& bi = bus_info_opt.value();
+        const BusInfo& bi = *bus_info;
         return json::Builder{}
             .StartDict()
                 .Key("curvature").Value(bi.curvature)
@@ -183,6 +198,192 @@ namespace jsonreader {
     }
 
 
+    transport_router::RouterType GetRouterType(const std::string& name) {
+        if (name == "all_pairs") {
+            return transport_router::RouterType::ALL_PAIRS;
+        }
+        if (name == "dijkstra") {
+            return transport_router::RouterType::DIJKSTRA;
+        }
+        if (name == "ch") {
+            return transport_router::RouterType::CONTRACTION_HIERARCHY;
+        }
+        if (name == "bidirectional") {
+            return transport_router::RouterType::BIDIRECTIONAL_DIJKSTRA;
+        }
+        if (name == "alt") {
+            return transport_router::RouterType::ALT;
+        }
+        if (name == "raptor") {
+            return transport_router::RouterType::RAPTOR;
+        }
+        if (name == "auto") {
+            return transport_router::RouterType::AUTO;
+        }
+        throw invalid_argument("Unknown router type: " + name);
+    }
+
+    std::string GetRouterName(transport_router::RouterType type) {
+        switch (type) {
+            case transport_router::RouterType::ALL_PAIRS:
+                return "all_pairs";
+            case transport_router::RouterType::DIJKSTRA:
+                return "dijkstra";
+            case transport_router::RouterType::CONTRACTION_HIERARCHY:
+                return "ch";
+            case transport_router::RouterType::BIDIRECTIONAL_DIJKSTRA:
+                return "bidirectional";
+            case transport_router::RouterType::ALT:
+                return "alt";
+            case transport_router::RouterType::RAPTOR:
+                return "raptor";
+            case transport_router::RouterType::AUTO:
+                return "auto";
+        }
+        throw invalid_argument("Unknown router type");
+    }
+
+    transport_router::GraphModel GetGraphModel(const std::string& name) {
+        if (name == "complete") {
+            return transport_router::GraphModel::COMPLETE;
+        }
+        if (name == "split") {
+            return transport_router::GraphModel::SPLIT;
+        }
+        throw invalid_argument("Unknown graph model: " + name);
+    }
+
+    transport_router::VertexOrder GetVertexOrder(const std::string& name) {
+        if (name == "catalogue") {
+            return transport_router::VertexOrder::CATALOGUE;
+        }
+        if (name == "hilbert") {
+            return transport_router::VertexOrder::HILBERT;
+        }
+        if (name == "rcm") {
+            return transport_router::VertexOrder::RCM;
+        }
+        throw invalid_argument("Unknown vertex order: " + name);
+    }
+
+    transport_router::TablePrecision GetTablePrecision(const std::string& name) {
+        if (name == "double") {
+            return transport_router::TablePrecision::DOUBLE;
+        }
+        if (name == "float") {
+            return transport_router::TablePrecision::FLOAT;
+        }
+        throw invalid_argument("Unknown table precision: " + name);
+    }
+
+    // Counters are reported as JSON ints; one that outgrows int shows as
+    // INT_MAX instead of wrapping round.
+    int ClampToInt(size_t count) {
+        return static_cast<int>(std::min<size_t>(count, std::numeric_limits<int>::max()));
+    }
+
+    json::Node ProcessDiagnosticsRequest(int id, const transport_catalogue::TransportCatalogue& tc,
+                                         const transport_router::TransportRouter& router) {
+        const transport_catalogue::ArenaStats arena = tc.GetArenaStats();
+        const cache::CacheStats route_cache = router.GetRouteCacheStats();
+        const graph::SearchStats search = router.GetSearchStats();
+        json::Array estimates;
+        for (const auto& estimate : router.EstimateRouters()) {
+            estimates.push_back(json::Builder{}
+                .StartDict()
+                    .Key("type").Value(GetRouterName(estimate.type))
+                    .Key("memory_mb").Value(estimate.memory_mb)
+                    .Key("build_ms").Value(estimate.build_ms)
+                    .Key("query_us").Value(estimate.query_us)
+                .EndDict()
+                .Build());
+        }
+        return json::Builder{}
+            .StartDict()
+                .Key("request_id").Value(id)
+                .Key("router").StartDict()
+                    .Key("type").Value(GetRouterName(router.GetRouterType()))
+                    .Key("estimates").Value(std::move(estimates))
+                .EndDict()
+                .Key("route_cache").StartDict()
+                    .Key("capacity").Value(ClampToInt(route_cache.capacity))
+                    .Key("size").Value(ClampToInt(route_cache.size))
+                    .Key("hits").Value(ClampToInt(route_cache.hits))
+                    .Key("misses").Value(ClampToInt(route_cache.misses))
+                .EndDict()
+                .Key("search").StartDict()
+                    .Key("searches").Value(ClampToInt(search.search_count))
+                    .Key("settled_vertices").Value(ClampToInt(search.settled_vertex_count))
+                .EndDict()
+                .Key("catalogue_arena").StartDict()
+                    .Key("allocations").Value(ClampToInt(arena.allocation_count))
+                    .Key("blocks").Value(ClampToInt(arena.block_count))
+                    .Key("block_bytes").Value(ClampToInt(arena.block_bytes))
+                .EndDict()
+            .EndDict()
+            .Build();
+    }
+
+    // Route and Isochrone requests take a search each, RouteTime too unless
+    // hub labels answer it; Matrix one per origin.
+    size_t CountRouteSearches(const json::Dict& root, bool hub_labels) {
+        if (!root.count("stat_requests")) {
+            return 0;
+        }
+        size_t count = 0;
+        for (const auto& request : root.at("stat_requests").AsArray()) {
+            const json::Dict& cmd = request.AsMap();
+            const std::string& type = cmd.at("type").AsString();
+            if (type == "Route" || type == "Isochrone" || (type == "RouteTime" && !hub_labels)) {
+                ++count;
+            } else if (type == "Matrix") {
+                count += cmd.at("origins").AsArray().size();
+            }
+        }
+        return count;
+    }
+
+    std::vector<std::string> GetStopNames(const json::Array& names) {
+        std::vector<std::string> result;
+        result.reserve(names.size());
+        for (const auto& name : names) {
+            result.push_back(name.AsString());
+        }
+        return result;
+    }
+
+    // Prints {"request_id": id, "times": [[...], ...]} one row at a time, so
+    // that the whole matrix never exists as a json::Node tree.
+    void OutputMatrixRequest(int id, const json::Dict& cmd, const transport_router::TransportRouter& router,
+                             std::ostream& output) {
+        output << "{\"request_id\":" << id << ",\"times\":[";
+        bool first_row = true;
+        router.ComputeTravelTimes(GetStopNames(cmd.at("origins").AsArray()),
+                                  GetStopNames(cmd.at("destinations").AsArray()),
+                                  [&](const std::vector<std::optional<double>>& times) {
+            json::Array row;
+            row.reserve(times.size());
+            for (const auto& time : times) {
+                row.push_back(time ? json::Node(*time) : json::Node(nullptr));
+            }
+            if (!first_row) {
+                output << ',';
+            }
+            first_row = false;
+            json::Print(json::Document(json::Node(std::move(row))), output);
+        });
+        output << "]}";
+    }
+
+    json::Node ProcessRouteTimeRequest(int id, double total_time) {
+        return json::Builder{}
+            .StartDict()
+                .Key("request_id").Value(id)
+                .Key("total_time").Value(total_time)
+            .EndDict()
+            .Build();
+    }
+
     json::Node ProcessUnknownRequest(int id) {
         return json::Builder{}
             .StartDict()
@@ -208,45 +409,128 @@ namespace jsonreader {
             if (rs.count("bus_velocity")) {
                 routing_settings.bus_velocity = rs.at("bus_velocity").AsDouble();
             }
+            if (rs.count("router")) {
+                routing_settings.router_type = GetRouterType(rs.at("router").AsString());
+            }
+            if (rs.count("graph_model")) {
+                routing_settings.graph_model = GetGraphModel(rs.at("graph_model").AsString());
+            }
+            if (rs.count("vertex_order")) {
+                routing_settings.vertex_order = GetVertexOrder(rs.at("vertex_order").AsString());
+            }
+            if (rs.count("table_precision")) {
+                routing_settings.table_precision = GetTablePrecision(rs.at("table_precision").AsString());
+            }
+            if (rs.count("route_cache_capacity")) {
+                const int capacity = rs.at("route_cache_capacity").AsInt();
+                if (capacity < 0) {
+                    throw invalid_argument("route_cache_capacity should be non-negative");
+                }
+                routing_settings.route_cache_capacity = static_cast<size_t>(capacity);
+            }
+            if (rs.count("landmark_count")) {
+                const int landmark_count = rs.at("landmark_count").AsInt();
+                if (landmark_count < 0) {
+                    throw invalid_argument("landmark_count should be non-negative");
+                }
+                routing_settings.landmark_count = static_cast<size_t>(landmark_count);
+            }
+            if (rs.count("max_router_memory_mb")) {
+                const int max_memory_mb = rs.at("max_router_memory_mb").AsInt();
+                if (max_memory_mb < 0) {
+                    throw invalid_argument("max_router_memory_mb should be non-negative");
+                }
+                routing_settings.max_router_memory_mb = static_cast<size_t>(max_memory_mb);
+            }
+            if (rs.count("prune_parallel_edges")) {
+                routing_settings.prune_parallel_edges = rs.at("prune_parallel_edges").AsBool();
+            }
+            if (rs.count("hub_labels")) {
+                routing_settings.hub_labels = rs.at("hub_labels").AsBool();
+            }
         }
 
-        transport_router::TransportRouter router(tc, routing_settings);
+        routing_settings.thread_count = GetThreadCount(root);
+        routing_settings.expected_query_count = CountRouteSearches(root, routing_settings.hub_labels);
+
+        std::unique_ptr<transport_router::TransportRouter> router;
+        if (root.count("serialization_settings")) {
+            const std::string& file = root.at("serialization_settings").AsMap().at("file").AsString();
+            router = std::make_unique<transport_router::TransportRouter>(tc, routing_settings, file);
+        } else {
+            router = std::make_unique<transport_router::TransportRouter>(tc, routing_settings);
+        }
 
         if (!root.count("stat_requests")) {
              return;
         }
 
         const json::Array& arr = root.at("stat_requests").AsArray();
-        json::Array results;
-        results.reserve(arr.size());
 
-        for (const auto& req_node : arr) {
-            const json::Dict& cmd = req_node.AsMap();
+        // Route requests sharing a source stop are answered together, so that
+        // query-time engines run one search per source instead of per request.
+        std::unordered_map<std::string, std::vector<size_t>> route_requests_by_from;
+        for (size_t i = 0; i < arr.size(); ++i) {
+            const json::Dict& cmd = arr[i].AsMap();
+            if (cmd.at("type").AsString() == "Route") {
+                route_requests_by_from[cmd.at("from").AsString()].push_back(i);
+            }
+        }
+        std::vector<std::shared_ptr<const transport_router::TransportRouter::FoundRoute>> found_routes(arr.size());
+        for (const auto& [from, indices] : route_requests_by_from) {
+            std::vector<std::string> destinations;
+            destinations.reserve(indices.size());
+            for (const size_t i : indices) {
+                destinations.push_back(arr[i].AsMap().at("to").AsString());
+            }
+            auto routes = router->FindRoutes(from, destinations);
+            for (size_t k = 0; k < indices.size(); ++k) {
+                found_routes[indices[k]] = std::move(routes[k]);
+            }
+        }
+
+        // Responses are printed as soon as they are ready instead of being
+        // collected into one document first.
+        output << '[';
+        for (size_t i = 0; i < arr.size(); ++i) {
+            const json::Dict& cmd = arr[i].AsMap();
             const int id = cmd.at("id").AsInt();
             const std::string type = cmd.at("type").AsString();
+            if (i > 0) {
+                output << ',';
+            }
 
+            if (type == "Matrix") {
+                OutputMatrixRequest(id, cmd, *router, output);
+                continue;
+            }
+            if (type == "Route" && found_routes[i]) {
+                transport_router::TransportRouter::PrintRoute(*found_routes[i], id, output);
+                continue;
+            }
+
+            json::Node result;
             if (type == "Map") {
-                results.push_back(ProcessMapRequest(id, rh, map_rend));
+                result = ProcessMapRequest(id, rh, map_rend);
             } else if (type == "Stop") {
-                results.push_back(ProcessStopRequest(id, cmd.at("name").AsString(), rh));
+                result = ProcessStopRequest(id, cmd.at("name").AsString(), rh);
             } else if (type == "Bus") {
-                results.push_back(ProcessBusRequest(id, cmd.at("name").AsString(), tc));
-            } else if (type == "Route") {
-                // read from/to and ask transport router
-                const std::string from = cmd.at("from").AsString();
-                const std::string to = cmd.at("to").AsString();
-                auto route_node_opt = router.FindRoute(from, to, id);
-                if (route_node_opt.has_value()) {
-                    results.push_back(route_node_opt.value());
-                } else {
-                    results.push_back(ProcessUnknownRequest(id));
-                }
+                result = ProcessBusRequest(id, cmd.at("name").AsString(), tc);
+            } else if (type == "RouteTime") {
+                const auto time = router->FindRouteTime(cmd.at("from").AsString(), cmd.at("to").AsString());
+                result = time ? ProcessRouteTimeRequest(id, *time) : ProcessUnknownRequest(id);
+            } else if (type == "Isochrone") {
+                auto isochrone = router->FindReachableStops(cmd.at("from").AsString(),
+                                                            cmd.at("max_time").AsDouble(), id);
+                result = isochrone ? std::move(*isochrone) : ProcessUnknownRequest(id);
+            } else if (type == "Diagnostics") {
+                result = ProcessDiagnosticsRequest(id, tc, *router);
             } else {
-                results.push_back(ProcessUnknownRequest(id));
+                result = ProcessUnknownRequest(id);
             }
+            json::Print(json::Document(std::move(result)), output);
         }
-
-        json::Print(json::Document(json::Node(std::move(results))), output);
+        output << ']';
     }
 
 }
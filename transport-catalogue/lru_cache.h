@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace cache {
+
+    struct CacheStats {
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    // Bounded map that evicts the least recently used entry. All methods lock
+    // a mutex, so one cache may be shared between threads; values are returned
+    // by copy and should be cheap to copy (e.g. shared pointers).
+    template <typename Key, typename Value, typename Hash = std::hash<Key>>
+    class LruCache {
+    public:
+        explicit LruCache(size_t capacity)
+            : capacity_(capacity) {
+            index_.reserve(capacity);
+        }
+
+        // Counts a hit or a miss and marks a found entry as most recent.
+        std::optional<Value> Get(const Key& key) {
+            std::lock_guard guard(mutex_);
+            const auto it = index_.find(key);
+            if (it == index_.end()) {
+                ++misses_;
+                return std::nullopt;
+            }
+            ++hits_;
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return it->second->second;
+        }
+
+        void Put(const Key& key, Value value) {
+            if (capacity_ == 0) {
+                return;
+            }
+            std::lock_guard guard(mutex_);
+            if (const auto it = index_.find(key); it != index_.end()) {
+                it->second->second = std::move(value);
+                entries_.splice(entries_.begin(), entries_, it->second);
+                return;
+            }
+            if (entries_.size() == capacity_) {
+                index_.erase(entries_.back().first);
+                entries_.pop_back();
+            }
+            entries_.emplace_front(key, std::move(value));
+            index_.emplace(key, entries_.begin());
+        }
+
+        // Drops every entry; hit and miss counts are kept.
+        void Clear() {
+            std::lock_guard guard(mutex_);
+            index_.clear();
+            entries_.clear();
+        }
+
+        CacheStats GetStats() const {
+            std::lock_guard guard(mutex_);
+            return {capacity_, entries_.size(), hits_, misses_};
+        }
+
+    private:
+        using Entries = std::list<std::pair<Key, Value>>;
+
+        const size_t capacity_;
+        mutable std::mutex mutex_;
+        // Most recently used first.
+        Entries entries_;
+        std::unordered_map<Key, typename Entries::iterator, Hash> index_;
+        size_t hits_ = 0;
+        size_t misses_ = 0;
+    };
+
+}
@@ -93,7 +93,7 @@ private:
 class MapRenderer {
 public:
     using RenderingObjects = std::optional<std::pair<
-        std::map<std::string, svg::Point>,
+        std::map<std::string, svg::Point, std::less<>>,
         std::map<std::string, std::pair<std::vector<svg::Point>, bool>>
     >>;
 
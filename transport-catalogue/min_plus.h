@@ -0,0 +1,216 @@
+#pragma once
+
+#include "graph.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace graph {
+
+    // Min-plus product step of the blocked Floyd-Warshall over square tiles of
+    // TILE x TILE cells stored row by row:
+    //   for k: for i: for j: if a[i][k] + b[k][j] < c[i][j] then
+    //       c[i][j] = a[i][k] + b[k][j], c_prev[i][j] = b_prev[k][j]
+    // a and b may alias c (the pivot row and column stay unchanged while they
+    // are used, because the pivot diagonal is zero). EdgeIndex is the type the
+    // predecessors are stored in.
+    template <typename Weight, typename EdgeIndex = EdgeId>
+    struct MinPlusKernel {
+        static constexpr Weight INFINITE_WEIGHT = std::numeric_limits<Weight>::has_infinity
+                                                  ? std::numeric_limits<Weight>::infinity()
+                                                  : std::numeric_limits<Weight>::max();
+
+        template <size_t TILE>
+        static void Relax(Weight* c, EdgeIndex* c_prev, const Weight* a, const Weight* b, const EdgeIndex* b_prev) {
+            for (size_t k = 0; k < TILE; ++k) {
+                const Weight* b_row = b + k * TILE;
+                const EdgeIndex* b_prev_row = b_prev + k * TILE;
+                for (size_t i = 0; i < TILE; ++i) {
+                    const Weight a_ik = a[i * TILE + k];
+                    if (a_ik == INFINITE_WEIGHT) {
+                        continue;
+                    }
+                    Weight* c_row = c + i * TILE;
+                    EdgeIndex* c_prev_row = c_prev + i * TILE;
+                    for (size_t j = 0; j < TILE; ++j) {
+                        if (b_row[j] == INFINITE_WEIGHT) {
+                            continue;
+                        }
+                        const Weight candidate = a_ik + b_row[j];
+                        if (candidate < c_row[j]) {
+                            c_row[j] = candidate;
+                            c_prev_row[j] = b_prev_row[j];
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // The same step with ties broken by the number of edges, hops[i][j] being
+    // that of the current route. Among routes of equal weight only one with
+    // fewer edges replaces the current one; with zero-weight edges plain
+    // comparison lets the blocked order leave predecessors that go round a
+    // cycle. Scalar, as only graphs with such edges take it.
+    template <size_t TILE, typename Weight, typename EdgeIndex, typename HopCount>
+    void RelaxByHops(Weight* c, EdgeIndex* c_prev, HopCount* c_hops, const Weight* a, const HopCount* a_hops,
+                     const Weight* b, const EdgeIndex* b_prev, const HopCount* b_hops) {
+        constexpr Weight INFINITE_WEIGHT = MinPlusKernel<Weight, EdgeIndex>::INFINITE_WEIGHT;
+        for (size_t k = 0; k < TILE; ++k) {
+            for (size_t i = 0; i < TILE; ++i) {
+                const Weight a_ik = a[i * TILE + k];
+                if (a_ik == INFINITE_WEIGHT) {
+                    continue;
+                }
+                const HopCount a_hops_ik = a_hops[i * TILE + k];
+                for (size_t j = 0; j < TILE; ++j) {
+                    const size_t b_cell = k * TILE + j;
+                    if (b[b_cell] == INFINITE_WEIGHT) {
+                        continue;
+                    }
+                    const size_t c_cell = i * TILE + j;
+                    const Weight candidate = a_ik + b[b_cell];
+                    const HopCount candidate_hops = a_hops_ik + b_hops[b_cell];
+                    if (candidate < c[c_cell] || (candidate == c[c_cell] && candidate_hops < c_hops[c_cell])) {
+                        c[c_cell] = candidate;
+                        c_prev[c_cell] = b_prev[b_cell];
+                        c_hops[c_cell] = candidate_hops;
+                    }
+                }
+            }
+        }
+    }
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    // Infinity needs no special casing here: inf + x is never below anything.
+    template <>
+    struct MinPlusKernel<double, EdgeId> {
+        static constexpr double INFINITE_WEIGHT = std::numeric_limits<double>::infinity();
+
+        template <size_t TILE>
+        static void Relax(double* c, EdgeId* c_prev, const double* a, const double* b, const EdgeId* b_prev) {
+            static_assert(sizeof(EdgeId) == sizeof(double), "Predecessors are blended as 64-bit lanes");
+#if defined(__AVX2__)
+            static_assert(TILE % 4 == 0, "Tile rows should fill whole AVX registers");
+#else
+            static_assert(TILE % 2 == 0, "Tile rows should fill whole SSE registers");
+#endif
+            for (size_t k = 0; k < TILE; ++k) {
+                const double* b_row = b + k * TILE;
+                const double* b_prev_row = reinterpret_cast<const double*>(b_prev + k * TILE);
+                for (size_t i = 0; i < TILE; ++i) {
+                    const double a_ik = a[i * TILE + k];
+                    if (a_ik == INFINITE_WEIGHT) {
+                        continue;
+                    }
+                    double* c_row = c + i * TILE;
+                    double* c_prev_row = reinterpret_cast<double*>(c_prev + i * TILE);
+#if defined(__AVX2__)
+                    const __m256d a_vec = _mm256_set1_pd(a_ik);
+                    for (size_t j = 0; j < TILE; j += 4) {
+                        const __m256d candidate = _mm256_add_pd(a_vec, _mm256_loadu_pd(b_row + j));
+                        const __m256d current = _mm256_loadu_pd(c_row + j);
+                        const __m256d less = _mm256_cmp_pd(candidate, current, _CMP_LT_OQ);
+                        _mm256_storeu_pd(c_row + j, _mm256_blendv_pd(current, candidate, less));
+                        _mm256_storeu_pd(c_prev_row + j, _mm256_blendv_pd(_mm256_loadu_pd(c_prev_row + j),
+                                                                          _mm256_loadu_pd(b_prev_row + j), less));
+                    }
+#else
+                    const __m128d a_vec = _mm_set1_pd(a_ik);
+                    for (size_t j = 0; j < TILE; j += 2) {
+                        const __m128d candidate = _mm_add_pd(a_vec, _mm_loadu_pd(b_row + j));
+                        const __m128d current = _mm_loadu_pd(c_row + j);
+                        const __m128d less = _mm_cmplt_pd(candidate, current);
+                        _mm_storeu_pd(c_row + j, _mm_or_pd(_mm_and_pd(less, candidate), _mm_andnot_pd(less, current)));
+                        _mm_storeu_pd(c_prev_row + j, _mm_or_pd(_mm_and_pd(less, _mm_loadu_pd(b_prev_row + j)),
+                                                                _mm_andnot_pd(less, _mm_loadu_pd(c_prev_row + j))));
+                    }
+#endif
+                }
+            }
+        }
+    };
+
+    // Float weights with 32-bit predecessors blend like the double kernel, on
+    // twice as many lanes; 16-bit predecessors take the comparison mask
+    // packed down to 16-bit lanes.
+    template <typename EdgeIndex>
+    struct MinPlusKernel<float, EdgeIndex> {
+        static_assert(sizeof(EdgeIndex) == 4 || sizeof(EdgeIndex) == 2,
+                      "Float tables store 32- or 16-bit predecessors");
+        static constexpr float INFINITE_WEIGHT = std::numeric_limits<float>::infinity();
+
+        template <size_t TILE>
+        static void Relax(float* c, EdgeIndex* c_prev, const float* a, const float* b, const EdgeIndex* b_prev) {
+#if defined(__AVX2__)
+            static_assert(TILE % 8 == 0, "Tile rows should fill whole AVX registers");
+#else
+            static_assert(TILE % 4 == 0, "Tile rows should fill whole SSE registers");
+#endif
+            for (size_t k = 0; k < TILE; ++k) {
+                const float* b_row = b + k * TILE;
+                const EdgeIndex* b_prev_row = b_prev + k * TILE;
+                for (size_t i = 0; i < TILE; ++i) {
+                    const float a_ik = a[i * TILE + k];
+                    if (a_ik == INFINITE_WEIGHT) {
+                        continue;
+                    }
+                    float* c_row = c + i * TILE;
+                    EdgeIndex* c_prev_row = c_prev + i * TILE;
+#if defined(__AVX2__)
+                    const __m256 a_vec = _mm256_set1_ps(a_ik);
+                    for (size_t j = 0; j < TILE; j += 8) {
+                        const __m256 candidate = _mm256_add_ps(a_vec, _mm256_loadu_ps(b_row + j));
+                        const __m256 current = _mm256_loadu_ps(c_row + j);
+                        const __m256 less = _mm256_cmp_ps(candidate, current, _CMP_LT_OQ);
+                        _mm256_storeu_ps(c_row + j, _mm256_blendv_ps(current, candidate, less));
+                        if constexpr (sizeof(EdgeIndex) == 4) {
+                            auto* c_prev_lanes = reinterpret_cast<float*>(c_prev_row + j);
+                            const auto* b_prev_lanes = reinterpret_cast<const float*>(b_prev_row + j);
+                            _mm256_storeu_ps(c_prev_lanes, _mm256_blendv_ps(_mm256_loadu_ps(c_prev_lanes),
+                                                                            _mm256_loadu_ps(b_prev_lanes), less));
+                        } else {
+                            const __m256i less_bits = _mm256_castps_si256(less);
+                            const __m128i less_16 = _mm_packs_epi32(_mm256_castsi256_si128(less_bits),
+                                                                    _mm256_extracti128_si256(less_bits, 1));
+                            auto* c_prev_lanes = reinterpret_cast<__m128i*>(c_prev_row + j);
+                            const auto* b_prev_lanes = reinterpret_cast<const __m128i*>(b_prev_row + j);
+                            _mm_storeu_si128(c_prev_lanes, _mm_blendv_epi8(_mm_loadu_si128(c_prev_lanes),
+                                                                           _mm_loadu_si128(b_prev_lanes), less_16));
+                        }
+                    }
+#else
+                    const __m128 a_vec = _mm_set1_ps(a_ik);
+                    for (size_t j = 0; j < TILE; j += 4) {
+                        const __m128 candidate = _mm_add_ps(a_vec, _mm_loadu_ps(b_row + j));
+                        const __m128 current = _mm_loadu_ps(c_row + j);
+                        const __m128 less = _mm_cmplt_ps(candidate, current);
+                        _mm_storeu_ps(c_row + j, _mm_or_ps(_mm_and_ps(less, candidate), _mm_andnot_ps(less, current)));
+                        if constexpr (sizeof(EdgeIndex) == 4) {
+                            auto* c_prev_lanes = reinterpret_cast<float*>(c_prev_row + j);
+                            const auto* b_prev_lanes = reinterpret_cast<const float*>(b_prev_row + j);
+                            _mm_storeu_ps(c_prev_lanes, _mm_or_ps(_mm_and_ps(less, _mm_loadu_ps(b_prev_lanes)),
+                                                                  _mm_andnot_ps(less, _mm_loadu_ps(c_prev_lanes))));
+                        } else {
+                            const __m128i less_bits = _mm_castps_si128(less);
+                            const __m128i less_16 = _mm_packs_epi32(less_bits, less_bits);
+                            auto* c_prev_lanes = reinterpret_cast<__m128i*>(c_prev_row + j);
+                            const auto* b_prev_lanes = reinterpret_cast<const __m128i*>(b_prev_row + j);
+                            _mm_storel_epi64(c_prev_lanes,
+                                             _mm_or_si128(_mm_and_si128(less_16, _mm_loadl_epi64(b_prev_lanes)),
+                                                          _mm_andnot_si128(less_16, _mm_loadl_epi64(c_prev_lanes))));
+                        }
+                    }
+#endif
+                }
+            }
+        }
+    };
+#endif
+
+}
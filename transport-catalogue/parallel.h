@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+    // Calls func(index) for every index in [0, count) using up to thread_count
+    // threads (the calling thread included). Indices are handed out one by one,
+    // so func must not depend on the order in which they are processed.
+    // The first exception thrown by func is rethrown once all threads finish.
+    template <typename Func>
+    void ForEachIndex(size_t count, size_t thread_count, Func func) {
+        thread_count = std::min(thread_count, count);
+        if (thread_count <= 1) {
+            for (size_t index = 0; index < count; ++index) {
+                func(index);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next_index{0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        auto worker = [&] {
+            try {
+                for (size_t index = next_index++; index < count; index = next_index++) {
+                    func(index);
+                }
+            } catch (...) {
+                std::lock_guard guard(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_index = count;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count - 1);
+        for (size_t i = 1; i < thread_count; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Runs phase_count phases in order on up to thread_count threads (the
+    // calling thread included), started once for all of them. Phase p calls
+    // func(p, index) for every index in [0, task_count(p)), handed out like
+    // ForEachIndex; no task of a phase starts before every task of the
+    // previous one is done. task_count is called by every thread and should
+    // be cheap. The first exception thrown by func is rethrown once all
+    // threads finish; the phases after it are skipped.
+    template <typename CountFunc, typename Func>
+    void ForEachIndexInPhases(size_t phase_count, size_t thread_count, CountFunc task_count, Func func) {
+        if (thread_count <= 1) {
+            for (size_t phase = 0; phase < phase_count; ++phase) {
+                const size_t count = task_count(phase);
+                for (size_t index = 0; index < count; ++index) {
+                    func(phase, index);
+                }
+            }
+            return;
+        }
+
+        std::atomic<size_t> next_index{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable phase_done;
+        size_t waiting_count = 0;
+        size_t finished_phases = 0;
+
+        // The last thread to finish a phase resets the index for the next one
+        // and wakes the others.
+        auto wait_for_phase = [&] {
+            std::unique_lock lock(mutex);
+            const size_t phase = finished_phases;
+            if (++waiting_count == thread_count) {
+                waiting_count = 0;
+                next_index = 0;
+                ++finished_phases;
+                phase_done.notify_all();
+                return;
+            }
+            phase_done.wait(lock, [&] { return finished_phases != phase; });
+        };
+
+        auto worker = [&] {
+            for (size_t phase = 0; phase < phase_count; ++phase) {
+                const size_t count = task_count(phase);
+                try {
+                    for (size_t index = next_index++; index < count && !failed; index = next_index++) {
+                        func(phase, index);
+                    }
+                } catch (...) {
+                    std::lock_guard guard(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    failed = true;
+                }
+                wait_for_phase();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count - 1);
+        for (size_t i = 1; i < thread_count; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+}
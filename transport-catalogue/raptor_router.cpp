@@ -0,0 +1,246 @@
+#include "raptor_router.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace transport_router {
+
+using namespace std;
+
+namespace {
+
+constexpr double INFINITE_TIME = numeric_limits<double>::infinity();
+
+}
+
+RaptorRouter::RaptorRouter(size_t stop_count, int bus_wait_time, double bus_velocity)
+    : stop_count_(stop_count)
+    , bus_wait_time_(bus_wait_time)
+    , bus_velocity_(bus_velocity)
+    , times_(stop_count, INFINITE_TIME)
+    , rides_(stop_count, {NONE, NONE, NONE})
+    , is_marked_(stop_count, false) {
+}
+
+void RaptorRouter::AddSequence(uint32_t bus_index, const vector<graph::VertexId>& stops,
+                               const vector<int64_t>& distances) {
+    if (frozen_) {
+        throw logic_error("Sequences should be added before freezing");
+    }
+    if (stops.size() != distances.size()) {
+        throw invalid_argument("Every stop of a sequence needs its distance");
+    }
+    for (const graph::VertexId stop : stops) {
+        CheckStop(stop);
+    }
+    sequences_.push_back({bus_index, sequence_stops_.size(), stops.size()});
+    sequence_stops_.insert(sequence_stops_.end(), stops.begin(), stops.end());
+    sequence_distances_.insert(sequence_distances_.end(), distances.begin(), distances.end());
+}
+
+void RaptorRouter::Freeze() {
+    if (frozen_) {
+        return;
+    }
+    // Counting sort of all visits by stop.
+    stop_visit_offsets_.assign(stop_count_ + 1, 0);
+    for (const graph::VertexId stop : sequence_stops_) {
+        ++stop_visit_offsets_[stop + 1];
+    }
+    for (size_t stop = 0; stop < stop_count_; ++stop) {
+        stop_visit_offsets_[stop + 1] += stop_visit_offsets_[stop];
+    }
+    stop_visits_.resize(sequence_stops_.size());
+    vector<size_t> next_visit(stop_visit_offsets_.begin(), stop_visit_offsets_.end() - 1);
+    for (uint32_t sequence_index = 0; sequence_index < sequences_.size(); ++sequence_index) {
+        const Sequence& sequence = sequences_[sequence_index];
+        for (uint32_t position = 0; position < sequence.size; ++position) {
+            const graph::VertexId stop = sequence_stops_[sequence.first + position];
+            stop_visits_[next_visit[stop]++] = {sequence_index, position};
+        }
+    }
+    scan_from_.assign(sequences_.size(), NONE);
+    frozen_ = true;
+}
+
+double RaptorRouter::GetRideTime(const Sequence& sequence, uint32_t board_position, uint32_t alight_position) const {
+    const int64_t distance = sequence_distances_[sequence.first + alight_position]
+                             - sequence_distances_[sequence.first + board_position];
+    return ComputeTravelTime(static_cast<double>(distance), bus_velocity_);
+}
+
+void RaptorRouter::Improve(graph::VertexId stop, double time, const Ride& ride) const {
+    if (times_[stop] == INFINITE_TIME) {
+        touched_stops_.push_back(stop);
+    }
+    times_[stop] = time;
+    rides_[stop] = ride;
+    ++stats_.settled_vertex_count;
+    if (!is_marked_[stop]) {
+        is_marked_[stop] = true;
+        next_marked_stops_.push_back(stop);
+    }
+}
+
+void RaptorRouter::ScanSequence(uint32_t sequence_index, uint32_t first_position, double bound) const {
+    const Sequence& sequence = sequences_[sequence_index];
+    uint32_t board_position = NONE;
+    double board_time = 0.0;
+    // Time at the first stop of the sequence if the bus had been boarded
+    // there; only used to compare boarding stops, the times themselves are
+    // added up the way graph edges are.
+    double board_key = 0.0;
+
+    for (uint32_t position = first_position; position < sequence.size; ++position) {
+        const graph::VertexId stop = sequence_stops_[sequence.first + position];
+        if (board_position != NONE) {
+            const double ride_time = bus_wait_time_ + GetRideTime(sequence, board_position, position);
+            const double time = board_time + ride_time;
+            if (time < times_[stop] && time <= bound) {
+                Improve(stop, time, {sequence_index, board_position, position});
+            }
+        }
+        if (times_[stop] != INFINITE_TIME) {
+            const double key = times_[stop] - ComputeTravelTime(
+                static_cast<double>(sequence_distances_[sequence.first + position]), bus_velocity_);
+            if (board_position == NONE || key < board_key) {
+                board_position = position;
+                board_time = times_[stop];
+                board_key = key;
+            }
+        }
+    }
+}
+
+template <typename GetBound>
+void RaptorRouter::Search(graph::VertexId from, GetBound get_bound) const {
+    if (!frozen_) {
+        throw logic_error("Router should be frozen before searching");
+    }
+    for (const graph::VertexId stop : touched_stops_) {
+        times_[stop] = INFINITE_TIME;
+        rides_[stop] = {NONE, NONE, NONE};
+    }
+    touched_stops_.clear();
+    ++stats_.search_count;
+
+    times_[from] = 0.0;
+    touched_stops_.push_back(from);
+    marked_stops_.assign(1, from);
+    double bound = get_bound();
+
+    while (!marked_stops_.empty()) {
+        for (const graph::VertexId stop : marked_stops_) {
+            is_marked_[stop] = false;
+            for (size_t visit = stop_visit_offsets_[stop]; visit < stop_visit_offsets_[stop + 1]; ++visit) {
+                const auto [sequence, position] = stop_visits_[visit];
+                if (scan_from_[sequence] == NONE) {
+                    queued_sequences_.push_back(sequence);
+                    scan_from_[sequence] = position;
+                } else {
+                    scan_from_[sequence] = min(scan_from_[sequence], position);
+                }
+            }
+        }
+        marked_stops_.clear();
+
+        for (const uint32_t sequence : queued_sequences_) {
+            const uint32_t first_position = scan_from_[sequence];
+            scan_from_[sequence] = NONE;
+            ScanSequence(sequence, first_position, bound);
+        }
+        queued_sequences_.clear();
+
+        swap(marked_stops_, next_marked_stops_);
+        bound = get_bound();
+    }
+}
+
+void RaptorRouter::SearchTargets(graph::VertexId from, const vector<graph::VertexId>& targets) const {
+    // No stop later than the latest target can lead to a better one.
+    Search(from, [this, &targets] {
+        double bound = 0.0;
+        for (const graph::VertexId target : targets) {
+            bound = max(bound, times_[target]);
+        }
+        return bound;
+    });
+}
+
+optional<RaptorRouter::Journey> RaptorRouter::ExtractJourney(graph::VertexId to) const {
+    if (times_[to] == INFINITE_TIME) {
+        return nullopt;
+    }
+    Journey journey{times_[to], {}};
+    for (graph::VertexId stop = to; rides_[stop].sequence != NONE;) {
+        const Ride& ride = rides_[stop];
+        const Sequence& sequence = sequences_[ride.sequence];
+        const graph::VertexId board_stop = sequence_stops_[sequence.first + ride.board_position];
+        journey.legs.push_back({board_stop, sequence.bus_index,
+                                static_cast<int>(ride.alight_position - ride.board_position),
+                                GetRideTime(sequence, ride.board_position, ride.alight_position)});
+        stop = board_stop;
+    }
+    reverse(journey.legs.begin(), journey.legs.end());
+    return journey;
+}
+
+void RaptorRouter::CheckStop(graph::VertexId stop) const {
+    if (stop >= stop_count_) {
+        throw out_of_range("Stop id is out of range");
+    }
+}
+
+vector<optional<RaptorRouter::Journey>> RaptorRouter::FindJourneys(graph::VertexId from,
+                                                                   const vector<graph::VertexId>& targets) const {
+    CheckStop(from);
+    for (const graph::VertexId to : targets) {
+        CheckStop(to);
+    }
+    SearchTargets(from, targets);
+
+    vector<optional<Journey>> journeys;
+    journeys.reserve(targets.size());
+    for (const graph::VertexId to : targets) {
+        journeys.push_back(ExtractJourney(to));
+    }
+    return journeys;
+}
+
+vector<pair<graph::VertexId, double>> RaptorRouter::FindReachableStops(graph::VertexId from, double max_time) const {
+    CheckStop(from);
+    Search(from, [max_time] {
+        return max_time;
+    });
+
+    vector<pair<graph::VertexId, double>> reachable;
+    for (const graph::VertexId stop : touched_stops_) {
+        if (times_[stop] <= max_time) {
+            reachable.emplace_back(stop, times_[stop]);
+        }
+    }
+    sort(reachable.begin(), reachable.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second != rhs.second ? lhs.second < rhs.second : lhs.first < rhs.first;
+    });
+    return reachable;
+}
+
+void RaptorRouter::ComputeTimes(const vector<graph::VertexId>& sources, const vector<graph::VertexId>& targets,
+                                const function<void(size_t, const TimeRow&)>& on_row) const {
+    for (const auto* stops : {&sources, &targets}) {
+        for (const graph::VertexId stop : *stops) {
+            CheckStop(stop);
+        }
+    }
+    TimeRow row(targets.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        SearchTargets(sources[i], targets);
+        for (size_t j = 0; j < targets.size(); ++j) {
+            row[j] = times_[targets[j]] == INFINITE_TIME ? nullopt : optional<double>(times_[targets[j]]);
+        }
+        on_row(i, row);
+    }
+}
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "graph.h"
+#include "router.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace transport_router {
+
+// Minutes a bus at bus_velocity km/h takes to cover distance meters.
+inline double ComputeTravelTime(double distance, double bus_velocity) {
+    return (distance / 1000.0) / bus_velocity * 60.0;
+}
+
+// One ride of a route: waiting at board_stop, then span_count stops on a bus.
+struct RouteLeg {
+    graph::VertexId board_stop;
+    uint32_t bus_index;
+    int span_count;
+    double travel_time;
+};
+
+// Round-based search (RAPTOR) straight over the stop sequences of the buses,
+// with the cost model of the routing graph: every boarding costs the wait
+// time, riding costs the distance over the velocity. Each round scans, in a
+// single pass, every sequence through a stop improved in the round before,
+// so nothing of size O(k^2) per bus is ever built.
+// Stops are numbered 0..stop_count-1. Scratch buffers are reused between
+// queries, so queries must not run concurrently on the same instance.
+class RaptorRouter {
+public:
+    struct Journey {
+        double total_time;
+        std::vector<RouteLeg> legs;
+    };
+
+    using TimeRow = std::vector<std::optional<double>>;
+
+    RaptorRouter(size_t stop_count, int bus_wait_time, double bus_velocity);
+
+    // distances[i] is the road distance from stops[0] to stops[i].
+    void AddSequence(uint32_t bus_index, const std::vector<graph::VertexId>& stops,
+                     const std::vector<int64_t>& distances);
+    // Indexes the sequences by stop; no sequence can be added afterwards.
+    void Freeze();
+
+    // Runs a single search that stops once every target is final.
+    std::vector<std::optional<Journey>> FindJourneys(graph::VertexId from,
+                                                     const std::vector<graph::VertexId>& targets) const;
+    // Stops reachable within max_time with their times, closest first.
+    std::vector<std::pair<graph::VertexId, double>> FindReachableStops(graph::VertexId from, double max_time) const;
+    // Same contract as graph::RouteEngine::ComputeWeights.
+    void ComputeTimes(const std::vector<graph::VertexId>& sources, const std::vector<graph::VertexId>& targets,
+                      const std::function<void(size_t, const TimeRow&)>& on_row) const;
+
+    graph::SearchStats GetSearchStats() const {
+        return stats_;
+    }
+
+private:
+    struct Sequence {
+        uint32_t bus_index;
+        size_t first;
+        size_t size;
+    };
+
+    struct StopVisit {
+        uint32_t sequence;
+        uint32_t position;
+    };
+
+    // The ride that gave a stop its current time.
+    struct Ride {
+        uint32_t sequence;
+        uint32_t board_position;
+        uint32_t alight_position;
+    };
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Runs rounds until no stop improves. Times above the bound returned by
+    // get_bound after each round are not recorded.
+    template <typename GetBound>
+    void Search(graph::VertexId from, GetBound get_bound) const;
+    void SearchTargets(graph::VertexId from, const std::vector<graph::VertexId>& targets) const;
+    void ScanSequence(uint32_t sequence_index, uint32_t first_position, double bound) const;
+    void Improve(graph::VertexId stop, double time, const Ride& ride) const;
+    std::optional<Journey> ExtractJourney(graph::VertexId to) const;
+    double GetRideTime(const Sequence& sequence, uint32_t board_position, uint32_t alight_position) const;
+    void CheckStop(graph::VertexId stop) const;
+
+    const size_t stop_count_;
+    const int bus_wait_time_;
+    const double bus_velocity_;
+    bool frozen_ = false;
+
+    std::vector<Sequence> sequences_;
+    std::vector<graph::VertexId> sequence_stops_;
+    std::vector<int64_t> sequence_distances_;
+    // Visits of stop s are stop_visits_[stop_visit_offsets_[s]..stop_visit_offsets_[s + 1]).
+    std::vector<size_t> stop_visit_offsets_;
+    std::vector<StopVisit> stop_visits_;
+
+    mutable std::vector<double> times_;
+    mutable std::vector<Ride> rides_;
+    mutable std::vector<graph::VertexId> touched_stops_;
+    mutable std::vector<bool> is_marked_;
+    mutable std::vector<graph::VertexId> marked_stops_;
+    mutable std::vector<graph::VertexId> next_marked_stops_;
+    // Earliest position of each sequence to scan in the current round.
+    mutable std::vector<uint32_t> scan_from_;
+    mutable std::vector<uint32_t> queued_sequences_;
+    mutable graph::SearchStats stats_;
+};
+
+}
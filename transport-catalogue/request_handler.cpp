@@ -18,18 +18,11 @@ optional<StopInfo> RequestHandler::GetStopInfo(string_view stop_name) const {
     const auto* stop = tc_.FindStop(stop_name);
     if (!stop) return nullopt;
 
-    StopInfo info;
-    info.name = stop->name;
-
-    auto buses = tc_.GetPassingBuses(stop->name);
-    info.buses.reserve(buses.size());
-    for (const auto* b : buses) info.buses.push_back(b);
-
-    return info;
+    return StopInfo{stop->name, tc_.GetSortedPassingBuses(stop->id)};
 }
 
 RequestHandler::RenderingObjects RequestHandler::GetRenderingObjects() const {
-    unordered_set<string> used_stop_names;
+    unordered_set<string_view> used_stop_names;
     for (const auto& bus : tc_.GetBuses()) {
         if (bus.route.size() < 2) continue;
         for (const auto* s : bus.route) {
@@ -50,10 +43,14 @@ RequestHandler::RenderingObjects RequestHandler::GetRenderingObjects() const {
 
     SphereProjector proj(coords.begin(), coords.end(), mr_.GetWidth(), mr_.GetHeight(), mr_.GetPadding());
 
-    map<string, svg::Point> stops_to_draw;
+    map<string, svg::Point, less<>> stops_to_draw;
     for (const auto& stop : tc_.GetStops()) {
         if (used_stop_names.count(stop.name)) {
-            stops_to_draw[stop.name] = proj(stop.coord);
+            // A stop added again under the same name replaces the earlier one.
+            const auto [it, inserted] = stops_to_draw.emplace(stop.name, proj(stop.coord));
+            if (!inserted) {
+                it->second = proj(stop.coord);
+            }
         }
     }
 
@@ -65,14 +62,14 @@ RequestHandler::RenderingObjects RequestHandler::GetRenderingObjects() const {
         pts.reserve(bus.route.size());
         for (const auto* s : bus.route) {
             if (!s) continue;
-            auto it = stops_to_draw.find(s->name);
+            auto it = stops_to_draw.find(string_view(s->name));
             if (it != stops_to_draw.end()) {
                 pts.push_back(it->second);
             }
         }
         if (pts.size() < 2) continue;
 
-        buses_to_draw[bus.name] = { move(pts), bus.is_round_trip };
+        buses_to_draw[string(bus.name)] = { move(pts), bus.is_round_trip };
     }
 
     return make_optional(make_pair(move(stops_to_draw), move(buses_to_draw)));
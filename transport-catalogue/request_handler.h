@@ -18,7 +18,7 @@ public:
 
     std::optional<StopInfo> GetStopInfo(std::string_view stop_name) const;
 
-    using RenderingObjects = std::optional<std::pair<std::map<std::string, svg::Point>, std::map<std::string, std::pair<std::vector<svg::Point>, bool>>>>;
+    using RenderingObjects = std::optional<std::pair<std::map<std::string, svg::Point, std::less<>>, std::map<std::string, std::pair<std::vector<svg::Point>, bool>>>>;
     RenderingObjects GetRenderingObjects() const;
     double ComputeDistance(const geo::Coordinates& a, const geo::Coordinates& b) const;
 
@@ -1,13 +1,18 @@
 #pragma once
 
 #include "graph.h"
+#include "min_plus.h"
+#include "parallel.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <iterator>
+#include <limits>
 #include <optional>
 #include <stdexcept>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -15,103 +20,483 @@
 namespace graph {
 
     template <typename Weight>
-    class Router {
+    struct RouteInfo {
+        Weight weight;
+        std::vector<EdgeId> edges;
+    };
+
+    // Work done by query-time engines; precomputed engines report zeros.
+    struct SearchStats {
+        size_t search_count = 0;
+        size_t settled_vertex_count = 0;
+    };
+
+    // Common interface of the shortest-path engines, so that callers can pick
+    // between precomputed tables and query-time searches at runtime.
+    template <typename Weight>
+    class RouteEngine {
+    public:
+        virtual ~RouteEngine() = default;
+        virtual std::optional<RouteInfo<Weight>> BuildRoute(VertexId from, VertexId to) const = 0;
+
+        // Routes from one source to each of targets, in the same order.
+        // Engines that search at query time override it to share one search.
+        virtual std::vector<std::optional<RouteInfo<Weight>>> BuildRoutes(VertexId from,
+                                                                          const std::vector<VertexId>& targets) const {
+            std::vector<std::optional<RouteInfo<Weight>>> routes;
+            routes.reserve(targets.size());
+            for (const VertexId to : targets) {
+                routes.push_back(BuildRoute(from, to));
+            }
+            return routes;
+        }
+
+        virtual SearchStats GetSearchStats() const {
+            return {};
+        }
+
+        // Catches up with edges [first_edge, edge count) added to the graph
+        // since the engine was built, the vertex set staying the same.
+        // Returns false when the engine cannot do that and has to be rebuilt.
+        virtual bool ApplyAddedEdges(EdgeId /*first_edge*/) {
+            return false;
+        }
+
+        using WeightRow = std::vector<std::optional<Weight>>;
+
+        // Route weights from each of sources to each of targets, without the
+        // routes themselves. on_row(i, row) receives the weights from
+        // sources[i] (empty when unreachable) as soon as that row is ready.
+        virtual void ComputeWeights(const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+                                    const std::function<void(size_t, const WeightRow&)>& on_row) const {
+            WeightRow row(targets.size());
+            for (size_t i = 0; i < sources.size(); ++i) {
+                for (size_t j = 0; j < targets.size(); ++j) {
+                    const auto route = BuildRoute(sources[i], targets[j]);
+                    row[j] = route ? std::optional<Weight>(route->weight) : std::nullopt;
+                }
+                on_row(i, row);
+            }
+        }
+    };
+
+    // Precomputes all pairs with a cache-blocked Floyd-Warshall over a dense
+    // weight matrix and a parallel predecessor matrix (the last edge of each
+    // route). Both are stored tile by tile, TILE x TILE cells per tile.
+    // The tiles of the pivot row and column, then the others, are relaxed on
+    // thread_count threads; each tile is written by exactly one thread, so
+    // the result does not depend on the thread count. Added edges are folded in at O(V^2) each.
+    // The tables may keep a narrower TableWeight than the graph and store
+    // predecessors as EdgeIndex, whose maximum marks a missing one. With a
+    // narrower TableWeight, routes are still traced through the tables but
+    // their weights are summed from the graph edges, so only routes within
+    // the table precision of each other can come out differently.
+    // On graphs with zero-weight edges ties are broken by the number of edges
+    // while the tables are built, and any row whose predecessors rounding
+    // still leaves going round a cycle is recomputed by Dijkstra's algorithm,
+    // which keeps every route traceable.
+    template <typename Weight, typename TableWeight = Weight, typename EdgeIndex = EdgeId>
+    class Router : public RouteEngine<Weight> {
     private:
         using Graph = DirectedWeightedGraph<Weight>;
 
     public:
-        explicit Router(const Graph& graph);
+        explicit Router(const Graph& graph, size_t thread_count = 1);
+        // Uses tables computed earlier for the same graph (see GetTableSize,
+        // GetWeights and GetPrevEdges), e.g. mapped from a snapshot file.
+        // They are not copied and must outlive the router.
+        Router(const Graph& graph, const TableWeight* weights, const EdgeIndex* prev_edges);
+
+        using RouteInfo = graph::RouteInfo<Weight>;
+
+        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const override;
+        // Reads the weights straight from an exact table.
+        void ComputeWeights(const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+                            const std::function<void(size_t, const typename RouteEngine<Weight>::WeightRow&)>& on_row)
+            const override;
+        // Tables passed to the constructor are copied before the first change.
+        bool ApplyAddedEdges(EdgeId first_edge) override;
 
-        struct RouteInfo {
-            Weight weight;
-            std::vector<EdgeId> edges;
-        };
+        static constexpr size_t TILE = 32;
 
-        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
+        static size_t GetTableSize(size_t vertex_count) {
+            const size_t tile_count = (vertex_count + TILE - 1) / TILE;
+            return tile_count * tile_count * TILE * TILE;
+        }
+        const TableWeight* GetWeights() const {
+            return weights_view_;
+        }
+        const EdgeIndex* GetPrevEdges() const {
+            return prev_edges_view_;
+        }
 
     private:
-        struct RouteInternalData {
-            Weight weight;
-            std::optional<EdgeId> prev_edge;
-        };
-        using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+        using Kernel = MinPlusKernel<TableWeight, EdgeIndex>;
+
+        static constexpr size_t TILE_CELLS = TILE * TILE;
+        static constexpr Weight ZERO_WEIGHT{};
+        static constexpr TableWeight INFINITE_WEIGHT = Kernel::INFINITE_WEIGHT;
+        static constexpr EdgeIndex NO_EDGE = std::numeric_limits<EdgeIndex>::max();
+        static constexpr bool IS_EXACT_TABLE = std::is_same_v<Weight, TableWeight>;
+
+        size_t GetCellIndex(VertexId from, VertexId to) const {
+            return ((from / TILE) * tile_count_ + to / TILE) * TILE_CELLS + (from % TILE) * TILE + to % TILE;
+        }
+
+        size_t GetTileIndex(size_t tile_row, size_t tile_column) const {
+            return (tile_row * tile_count_ + tile_column) * TILE_CELLS;
+        }
+
+        static bool HasZeroWeightEdges(const Graph& graph) {
+            for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+                const auto& edge = graph.GetEdge(edge_id);
+                if (edge.weight == ZERO_WEIGHT && edge.from != edge.to) {
+                    return true;
+                }
+            }
+            return false;
+        }
 
         void InitializeRoutesInternalData(const Graph& graph) {
-            const size_t vertex_count = graph.GetVertexCount();
-            for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
-                routes_internal_data_[vertex][vertex] = RouteInternalData{ZERO_WEIGHT, std::nullopt};
+            for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+                weights_[GetCellIndex(vertex, vertex)] = ZERO_WEIGHT;
                 for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
                     const auto& edge = graph.GetEdge(edge_id);
                     if (edge.weight < ZERO_WEIGHT) {
                         throw std::domain_error("Edges' weights should be non-negative");
                     }
-                    auto& route_internal_data = routes_internal_data_[vertex][edge.to];
-                    if (!route_internal_data || route_internal_data->weight > edge.weight) {
-                        route_internal_data = RouteInternalData{edge.weight, edge_id};
+                    const size_t cell = GetCellIndex(vertex, edge.to);
+                    const TableWeight weight = static_cast<TableWeight>(edge.weight);
+                    if (weights_[cell] > weight) {
+                        weights_[cell] = weight;
+                        prev_edges_[cell] = static_cast<EdgeIndex>(edge_id);
+                        if (!hop_counts_.empty()) {
+                            hop_counts_[cell] = 1;
+                        }
                     }
                 }
             }
         }
 
-        void RelaxRoute(VertexId vertex_from, VertexId vertex_to, const RouteInternalData& route_from,
-                        const RouteInternalData& route_to) {
-            auto& route_relaxing = routes_internal_data_[vertex_from][vertex_to];
-            const Weight candidate_weight = route_from.weight + route_to.weight;
-            if (!route_relaxing || candidate_weight < route_relaxing->weight) {
-                route_relaxing = {candidate_weight,
-                                route_to.prev_edge ? route_to.prev_edge : route_from.prev_edge};
+        // c(row, column) = min(c(row, column), c(row, pivot) + c(pivot, column))
+        void RelaxTile(size_t row, size_t column, size_t pivot) {
+            const size_t c = GetTileIndex(row, column);
+            const size_t a = GetTileIndex(row, pivot);
+            const size_t b = GetTileIndex(pivot, column);
+            if (!hop_counts_.empty()) {
+                RelaxByHops<TILE>(weights_.data() + c, prev_edges_.data() + c, hop_counts_.data() + c,
+                                  weights_.data() + a, hop_counts_.data() + a,
+                                  weights_.data() + b, prev_edges_.data() + b, hop_counts_.data() + b);
+                return;
             }
+            Kernel::template Relax<TILE>(weights_.data() + c, prev_edges_.data() + c,
+                                         weights_.data() + a, weights_.data() + b, prev_edges_.data() + b);
         }
 
-        void RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through) {
-            for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
-                if (const auto& route_from = routes_internal_data_[vertex_from][vertex_through]) {
-                    for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
-                        if (const auto& route_to = routes_internal_data_[vertex_through][vertex_to]) {
-                            RelaxRoute(vertex_from, vertex_to, *route_from, *route_to);
+        // Three phases per pivot tile: the pivot tile itself, then the other
+        // tiles of its row and column, then every remaining row of tiles.
+        // The worker threads are started once for the whole build.
+        void RelaxRoutesInternalData(size_t thread_count) {
+            const auto task_count = [this](size_t phase) -> size_t {
+                switch (phase % 3) {
+                    case 0: return 1;
+                    case 1: return 2 * (tile_count_ - 1);
+                    default: return tile_count_;
+                }
+            };
+            parallel::ForEachIndexInPhases(3 * tile_count_, thread_count, task_count,
+                                           [this](size_t phase, size_t index) {
+                const size_t pivot = phase / 3;
+                switch (phase % 3) {
+                    case 0:
+                        RelaxTile(pivot, pivot, pivot);
+                        break;
+                    case 1: {
+                        const size_t tile = index / 2 < pivot ? index / 2 : index / 2 + 1;
+                        if (index % 2 == 0) {
+                            RelaxTile(pivot, tile, pivot);
+                        } else {
+                            RelaxTile(tile, pivot, pivot);
+                        }
+                        break;
+                    }
+                    default:
+                        if (index == pivot) {
+                            break;
+                        }
+                        for (size_t column = 0; column < tile_count_; ++column) {
+                            if (column != pivot) {
+                                RelaxTile(index, column, pivot);
+                            }
                         }
+                }
+            });
+        }
+
+        // Walks the predecessors of every vertex in the row of from; states
+        // are 0 for unvisited, 1 on the current walk and 2 for done vertices.
+        bool HasPredecessorCycle(VertexId from, std::vector<uint8_t>& states) const {
+            std::fill(states.begin(), states.end(), uint8_t{0});
+            std::vector<VertexId> walk;
+            for (VertexId start = 0; start < vertex_count_; ++start) {
+                VertexId vertex = start;
+                while (states[vertex] == 0) {
+                    states[vertex] = 1;
+                    walk.push_back(vertex);
+                    const EdgeIndex edge_id = prev_edges_[GetCellIndex(from, vertex)];
+                    if (edge_id == NO_EDGE) {
+                        break;
                     }
+                    vertex = graph_.GetEdge(edge_id).from;
+                }
+                if (states[vertex] == 1 && prev_edges_[GetCellIndex(from, vertex)] != NO_EDGE) {
+                    return true;
+                }
+                for (const VertexId visited : walk) {
+                    states[visited] = 2;
                 }
+                walk.clear();
             }
+            return false;
+        }
+
+        // Dijkstra's algorithm only sets a predecessor from a vertex settled
+        // earlier, so the row it leaves has no cycles.
+        void RebuildRow(VertexId from) {
+            std::vector<Weight> weights(vertex_count_, std::numeric_limits<Weight>::max());
+            std::vector<EdgeIndex> prev_edges(vertex_count_, NO_EDGE);
+            using QueueItem = std::pair<Weight, VertexId>;
+            std::vector<QueueItem> queue{{ZERO_WEIGHT, from}};
+            weights[from] = ZERO_WEIGHT;
+            while (!queue.empty()) {
+                std::pop_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+                const auto [weight, vertex] = queue.back();
+                queue.pop_back();
+                if (weight > weights[vertex]) {
+                    continue;
+                }
+                for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+                    const auto& edge = graph_.GetEdge(edge_id);
+                    const Weight candidate = weight + edge.weight;
+                    if (candidate < weights[edge.to]) {
+                        weights[edge.to] = candidate;
+                        prev_edges[edge.to] = static_cast<EdgeIndex>(edge_id);
+                        queue.push_back({candidate, edge.to});
+                        std::push_heap(queue.begin(), queue.end(), std::greater<QueueItem>{});
+                    }
+                }
+            }
+            for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+                const size_t cell = GetCellIndex(from, vertex);
+                weights_[cell] = prev_edges[vertex] == NO_EDGE && vertex != from
+                                 ? INFINITE_WEIGHT
+                                 : static_cast<TableWeight>(weights[vertex]);
+                prev_edges_[cell] = prev_edges[vertex];
+            }
+        }
+
+        void CheckEdgeCount() const {
+            if (graph_.GetEdgeCount() > NO_EDGE) {
+                throw std::length_error("Edge ids do not fit into the predecessor table");
+            }
+        }
+
+        void InsertEdge(EdgeId edge_id);
+
+        // Appends the edges of the route to edges, last edge first. No route
+        // has more edges than there are vertices, so a longer trace means the
+        // predecessors go round a cycle. Tables mapped from a snapshot are
+        // not checksummed, so every predecessor is checked to be an edge
+        // into the vertex reached so far.
+        void TraceRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+            const size_t first_edge = edges.size();
+            VertexId vertex = to;
+            for (EdgeIndex edge_id = prev_edges_view_[GetCellIndex(from, vertex)];
+                edge_id != NO_EDGE;
+                edge_id = prev_edges_view_[GetCellIndex(from, vertex)])
+            {
+                if (edge_id >= graph_.GetEdgeCount() || graph_.GetEdge(edge_id).to != vertex) {
+                    throw std::runtime_error("Predecessor table is corrupt");
+                }
+                if (edges.size() - first_edge == vertex_count_) {
+                    throw std::logic_error("Predecessor table has a cycle");
+                }
+                edges.push_back(edge_id);
+                vertex = graph_.GetEdge(edge_id).from;
+            }
+            if (vertex != from) {
+                throw std::runtime_error("Predecessor table is corrupt");
+            }
+        }
+
+        Weight SumWeights(const std::vector<EdgeId>& edges) const {
+            Weight weight = ZERO_WEIGHT;
+            for (const EdgeId edge_id : edges) {
+                weight += graph_.GetEdge(edge_id).weight;
+            }
+            return weight;
         }
 
-        static constexpr Weight ZERO_WEIGHT{};
         const Graph& graph_;
-        RoutesInternalData routes_internal_data_;
+        size_t vertex_count_;
+        size_t tile_count_;
+        std::vector<TableWeight> weights_;
+        std::vector<EdgeIndex> prev_edges_;
+        const TableWeight* weights_view_;
+        const EdgeIndex* prev_edges_view_;
+        // Edges of each route, only while the tables of a graph with
+        // zero-weight edges are built.
+        std::vector<uint32_t> hop_counts_;
     };
 
-    template <typename Weight>
-    Router<Weight>::Router(const Graph& graph)
+    template <typename Weight, typename TableWeight, typename EdgeIndex>
+    Router<Weight, TableWeight, EdgeIndex>::Router(const Graph& graph, size_t thread_count)
         : graph_(graph)
-        , routes_internal_data_(graph.GetVertexCount(),
-                                std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()))
+        , vertex_count_(graph.GetVertexCount())
+        , tile_count_((vertex_count_ + TILE - 1) / TILE)
+        , weights_(GetTableSize(vertex_count_), INFINITE_WEIGHT)
+        , prev_edges_(GetTableSize(vertex_count_), NO_EDGE)
+        , weights_view_(weights_.data())
+        , prev_edges_view_(prev_edges_.data())
     {
+        CheckEdgeCount();
+        if (HasZeroWeightEdges(graph)) {
+            hop_counts_.assign(GetTableSize(vertex_count_), 0);
+        }
         InitializeRoutesInternalData(graph);
 
-        const size_t vertex_count = graph.GetVertexCount();
-        for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
-            RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
+        RelaxRoutesInternalData(thread_count);
+        if (!hop_counts_.empty()) {
+            hop_counts_ = {};
+            std::vector<uint8_t> states(vertex_count_);
+            for (VertexId from = 0; from < vertex_count_; ++from) {
+                if (HasPredecessorCycle(from, states)) {
+                    RebuildRow(from);
+                }
+            }
         }
     }
 
-    template <typename Weight>
-    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from,
-                                                                                VertexId to) const {
-        const auto& route_internal_data = routes_internal_data_.at(from).at(to);
-        if (!route_internal_data) {
+    template <typename Weight, typename TableWeight, typename EdgeIndex>
+    Router<Weight, TableWeight, EdgeIndex>::Router(const Graph& graph, const TableWeight* weights,
+                                                   const EdgeIndex* prev_edges)
+        : graph_(graph)
+        , vertex_count_(graph.GetVertexCount())
+        , tile_count_((vertex_count_ + TILE - 1) / TILE)
+        , weights_view_(weights)
+        , prev_edges_view_(prev_edges)
+    {
+        CheckEdgeCount();
+    }
+
+    template <typename Weight, typename TableWeight, typename EdgeIndex>
+    bool Router<Weight, TableWeight, EdgeIndex>::ApplyAddedEdges(EdgeId first_edge) {
+        if (graph_.GetVertexCount() != vertex_count_ || graph_.GetEdgeCount() > NO_EDGE) {
+            return false;
+        }
+        if (weights_view_ != weights_.data()) {
+            const size_t table_size = GetTableSize(vertex_count_);
+            weights_.assign(weights_view_, weights_view_ + table_size);
+            prev_edges_.assign(prev_edges_view_, prev_edges_view_ + table_size);
+            weights_view_ = weights_.data();
+            prev_edges_view_ = prev_edges_.data();
+        }
+        for (EdgeId edge_id = first_edge; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+            InsertEdge(edge_id);
+        }
+        return true;
+    }
+
+    // A route can only get shorter by becoming from -> edge.from -> edge.to -> to.
+    // With non-negative weights neither the column of edge.from nor the row of
+    // edge.to changes, so both are read while the other cells are written.
+    template <typename Weight, typename TableWeight, typename EdgeIndex>
+    void Router<Weight, TableWeight, EdgeIndex>::InsertEdge(EdgeId edge_id) {
+        const auto& edge = graph_.GetEdge(edge_id);
+        if (edge.weight < ZERO_WEIGHT) {
+            throw std::domain_error("Edges' weights should be non-negative");
+        }
+        const TableWeight edge_weight = static_cast<TableWeight>(edge.weight);
+        if (!(edge_weight < weights_[GetCellIndex(edge.from, edge.to)])) {
+            return;
+        }
+
+        std::vector<std::pair<VertexId, TableWeight>> heads;
+        std::vector<VertexId> tails;
+        for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+            const TableWeight head_weight = weights_[GetCellIndex(vertex, edge.from)];
+            if (head_weight != INFINITE_WEIGHT) {
+                heads.emplace_back(vertex, head_weight + edge_weight);
+            }
+            if (weights_[GetCellIndex(edge.to, vertex)] != INFINITE_WEIGHT) {
+                tails.push_back(vertex);
+            }
+        }
+
+        for (const auto& [from, head_weight] : heads) {
+            for (const VertexId to : tails) {
+                const size_t tail_cell = GetCellIndex(edge.to, to);
+                const TableWeight candidate = head_weight + weights_[tail_cell];
+                const size_t cell = GetCellIndex(from, to);
+                if (candidate < weights_[cell]) {
+                    weights_[cell] = candidate;
+                    prev_edges_[cell] = to == edge.to ? static_cast<EdgeIndex>(edge_id) : prev_edges_[tail_cell];
+                }
+            }
+        }
+    }
+
+    template <typename Weight, typename TableWeight, typename EdgeIndex>
+    std::optional<typename Router<Weight, TableWeight, EdgeIndex>::RouteInfo>
+    Router<Weight, TableWeight, EdgeIndex>::BuildRoute(VertexId from, VertexId to) const {
+        if (from >= vertex_count_ || to >= vertex_count_) {
+            throw std::out_of_range("Vertex id is out of range");
+        }
+        const TableWeight table_weight = weights_view_[GetCellIndex(from, to)];
+        if (table_weight == INFINITE_WEIGHT) {
             return std::nullopt;
         }
-        const Weight weight = route_internal_data->weight;
         std::vector<EdgeId> edges;
-        for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
-            edge_id;
-            edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge)
-        {
-            edges.push_back(*edge_id);
+        TraceRoute(from, to, edges);
+        Weight weight;
+        if constexpr (IS_EXACT_TABLE) {
+            weight = table_weight;
+        } else {
+            weight = SumWeights(edges);
         }
         std::reverse(edges.begin(), edges.end());
 
         return RouteInfo{weight, std::move(edges)};
-    }   
+    }
+
+    template <typename Weight, typename TableWeight, typename EdgeIndex>
+    void Router<Weight, TableWeight, EdgeIndex>::ComputeWeights(
+            const std::vector<VertexId>& sources, const std::vector<VertexId>& targets,
+            const std::function<void(size_t, const typename RouteEngine<Weight>::WeightRow&)>& on_row) const {
+        for (const auto* vertices : {&sources, &targets}) {
+            for (const VertexId vertex : *vertices) {
+                if (vertex >= vertex_count_) {
+                    throw std::out_of_range("Vertex id is out of range");
+                }
+            }
+        }
+        typename RouteEngine<Weight>::WeightRow row(targets.size());
+        std::vector<EdgeId> edges;
+        for (size_t i = 0; i < sources.size(); ++i) {
+            for (size_t j = 0; j < targets.size(); ++j) {
+                const TableWeight table_weight = weights_view_[GetCellIndex(sources[i], targets[j])];
+                if (table_weight == INFINITE_WEIGHT) {
+                    row[j].reset();
+                } else if constexpr (IS_EXACT_TABLE) {
+                    row[j] = table_weight;
+                } else {
+                    edges.clear();
+                    TraceRoute(sources[i], targets[j], edges);
+                    row[j] = SumWeights(edges);
+                }
+            }
+            on_row(i, row);
+        }
+    }
 
 }
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace snapshot {
+
+using namespace std;
+
+namespace {
+
+constexpr char MAGIC[8] = {'T', 'C', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr size_t SECTION_ALIGNMENT = 64;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t settings_hash;
+    uint64_t catalogue_hash;
+    uint32_t section_count;
+    uint32_t reserved;
+    uint64_t header_checksum;
+};
+
+struct SectionEntry {
+    uint32_t id;
+    uint32_t checksummed;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+size_t AlignUp(size_t value) {
+    return (value + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+uint64_t ComputeHeaderChecksum(FileHeader header, const SectionEntry* entries) {
+    header.header_checksum = 0;
+    Hasher hasher;
+    hasher.AddValue(header);
+    hasher.Add(entries, header.section_count * sizeof(SectionEntry));
+    return hasher.Get();
+}
+
+uint64_t ComputeChecksum(const void* data, size_t size) {
+    Hasher hasher;
+    hasher.Add(data, size);
+    return hasher.Get();
+}
+
+} // namespace
+
+void Hasher::Add(const void* data, size_t size) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash_ ^= bytes[i];
+        hash_ *= 1099511628211ULL;
+    }
+}
+
+void Hasher::AddString(string_view str) {
+    AddValue(str.size());
+    Add(str.data(), str.size());
+}
+
+uint64_t Hasher::Get() const {
+    return hash_;
+}
+
+void Writer::AddSection(uint32_t id, const void* data, size_t size, bool checksummed) {
+    sections_.push_back({id, data, size, checksummed});
+}
+
+void Writer::Save(const filesystem::path& path, uint64_t settings_hash, uint64_t catalogue_hash) const {
+    FileHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.settings_hash = settings_hash;
+    header.catalogue_hash = catalogue_hash;
+    header.section_count = static_cast<uint32_t>(sections_.size());
+
+    vector<SectionEntry> entries;
+    entries.reserve(sections_.size());
+    size_t offset = AlignUp(sizeof(FileHeader) + sections_.size() * sizeof(SectionEntry));
+    for (const auto& section : sections_) {
+        entries.push_back({section.id, section.checksummed, offset, section.size,
+                           section.checksummed ? ComputeChecksum(section.data, section.size) : 0});
+        offset = AlignUp(offset + section.size);
+    }
+    header.header_checksum = ComputeHeaderChecksum(header, entries.data());
+
+    filesystem::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        ofstream out(temp_path, ios::binary | ios::trunc);
+        if (!out) {
+            throw runtime_error("Cannot write snapshot " + temp_path.string());
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SectionEntry));
+
+        size_t position = sizeof(FileHeader) + entries.size() * sizeof(SectionEntry);
+        const char padding[SECTION_ALIGNMENT] = {};
+        for (size_t i = 0; i < sections_.size(); ++i) {
+            out.write(padding, entries[i].offset - position);
+            out.write(static_cast<const char*>(sections_[i].data), sections_[i].size);
+            position = entries[i].offset + sections_[i].size;
+        }
+        if (!out) {
+            throw runtime_error("Cannot write snapshot " + temp_path.string());
+        }
+    }
+    filesystem::rename(temp_path, path);
+}
+
+optional<Reader> Reader::Open(const filesystem::path& path, uint64_t settings_hash, uint64_t catalogue_hash) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullopt;
+    }
+    struct stat file_stat {};
+    if (::fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(FileHeader)) {
+        ::close(fd);
+        return nullopt;
+    }
+
+    Reader reader;
+    reader.size_ = static_cast<size_t>(file_stat.st_size);
+    void* mapping = ::mmap(nullptr, reader.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return nullopt;
+    }
+    reader.data_ = static_cast<const std::byte*>(mapping);
+
+    FileHeader header;
+    memcpy(&header, reader.data_, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION
+        || header.byte_order != BYTE_ORDER_MARK || header.settings_hash != settings_hash
+        || header.catalogue_hash != catalogue_hash) {
+        return nullopt;
+    }
+
+    const size_t table_end = sizeof(FileHeader) + header.section_count * sizeof(SectionEntry);
+    if (table_end > reader.size_) {
+        return nullopt;
+    }
+    vector<SectionEntry> entries(header.section_count);
+    memcpy(entries.data(), reader.data_ + sizeof(FileHeader), entries.size() * sizeof(SectionEntry));
+    if (ComputeHeaderChecksum(header, entries.data()) != header.header_checksum) {
+        return nullopt;
+    }
+
+    for (const auto& entry : entries) {
+        if (entry.offset % SECTION_ALIGNMENT != 0 || entry.offset > reader.size_
+            || entry.size > reader.size_ - entry.offset) {
+            return nullopt;
+        }
+        const Section section{reader.data_ + entry.offset, entry.size};
+        if (entry.checksummed && ComputeChecksum(section.data, section.size) != entry.checksum) {
+            return nullopt;
+        }
+        reader.sections_.emplace_back(entry.id, section);
+    }
+    return reader;
+}
+
+Reader::Reader(Reader&& other) noexcept
+    : data_(exchange(other.data_, nullptr))
+    , size_(exchange(other.size_, 0))
+    , sections_(move(other.sections_)) {
+}
+
+Reader& Reader::operator=(Reader&& other) noexcept {
+    if (this != &other) {
+        Unmap();
+        data_ = exchange(other.data_, nullptr);
+        size_ = exchange(other.size_, 0);
+        sections_ = move(other.sections_);
+    }
+    return *this;
+}
+
+Reader::~Reader() {
+    Unmap();
+}
+
+void Reader::Unmap() {
+    if (data_) {
+        ::munmap(const_cast<std::byte*>(data_), size_);
+        data_ = nullptr;
+    }
+}
+
+optional<Section> Reader::GetSection(uint32_t id) const {
+    for (const auto& [section_id, section] : sections_) {
+        if (section_id == id) {
+            return section;
+        }
+    }
+    return nullopt;
+}
+
+} // namespace snapshot
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace snapshot {
+
+    inline constexpr uint32_t FORMAT_VERSION = 4;
+
+    // 64-bit FNV-1a, used for fingerprints and section checksums.
+    class Hasher {
+    public:
+        void Add(const void* data, size_t size);
+        void AddString(std::string_view str);
+
+        template <typename T>
+        void AddValue(const T& value) {
+            Add(&value, sizeof(value));
+        }
+
+        uint64_t Get() const;
+
+    private:
+        uint64_t hash_ = 14695981039346656037ULL;
+    };
+
+    struct Section {
+        const std::byte* data = nullptr;
+        size_t size = 0;
+
+        template <typename T>
+        const T* As() const {
+            return reinterpret_cast<const T*>(data);
+        }
+
+        template <typename T>
+        size_t Count() const {
+            return size / sizeof(T);
+        }
+    };
+
+    // Collects sections by reference and writes them to a file. The data
+    // must stay alive until Save returns.
+    class Writer {
+    public:
+        // Checksummed sections are verified on every load; leave the large
+        // ones unchecked so that loading them stays a lazy page-in.
+        void AddSection(uint32_t id, const void* data, size_t size, bool checksummed);
+
+        // Writes into a temporary file next to path and renames it, so that
+        // readers never see a half-written snapshot. Throws std::runtime_error.
+        void Save(const std::filesystem::path& path, uint64_t settings_hash, uint64_t catalogue_hash) const;
+
+    private:
+        struct PendingSection {
+            uint32_t id;
+            const void* data;
+            size_t size;
+            bool checksummed;
+        };
+
+        std::vector<PendingSection> sections_;
+    };
+
+    // Memory-maps a snapshot read-only. Sections point into the mapping and
+    // stay valid while the reader is alive.
+    class Reader {
+    public:
+        // Returns nullopt when the file is missing, malformed, of another
+        // format version or built from other settings or catalogue data.
+        static std::optional<Reader> Open(const std::filesystem::path& path, uint64_t settings_hash,
+                                          uint64_t catalogue_hash);
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        Reader(Reader&& other) noexcept;
+        Reader& operator=(Reader&& other) noexcept;
+        ~Reader();
+
+        std::optional<Section> GetSection(uint32_t id) const;
+
+    private:
+        Reader() = default;
+        void Unmap();
+
+        const std::byte* data_ = nullptr;
+        size_t size_ = 0;
+        std::vector<std::pair<uint32_t, Section>> sections_;
+    };
+
+}
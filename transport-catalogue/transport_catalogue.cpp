@@ -1,60 +1,181 @@
 #include "transport_catalogue.h"
 #include "domain.h"
+#include "parallel.h"
 
+#include <algorithm>
+#include <numeric>
 #include <optional>
+#include <stdexcept>
 
 using namespace std;
 using namespace transport_catalogue;
 
-void TransportCatalogue::AddStop(Stop stop) {
-    stops_.push_back(move(stop));
+void TransportCatalogue::AddStop(string_view name, geo::Coordinates coord) {
+    length_offsets_.clear();
+    bus_infos_.clear();
+    passing_bus_offsets_.clear();
+    const auto id = static_cast<StopId>(stops_.size());
+    stops_.push_back({pmr::string(name, &arena_counter_), coord, id});
     const auto& inserted = stops_.back();
-    stopname_to_stop_[inserted.name] = &inserted;
-    passing_buses_.try_emplace(inserted.name, set<Bus*>{});
+    stopname_to_id_.insert_or_assign(pmr::string(name, &arena_counter_), inserted.id);
+    passing_buses_.emplace_back();
 }
 
-void TransportCatalogue::AddBus(Bus bus) {
+void TransportCatalogue::AddBus(string_view name, const vector<const Stop*>& route, bool is_round_trip) {
+    bus_infos_.clear();
+    passing_bus_offsets_.clear();
+    Bus bus{pmr::string(name, &arena_counter_), pmr::vector<const Stop*>(route.begin(), route.end(), &arena_counter_),
+            is_round_trip, static_cast<BusId>(buses_.size()), pmr::vector<StopId>(&arena_counter_)};
+    bus.stop_ids.reserve(route.size());
+    for (const auto* s : route) {
+        bus.stop_ids.push_back(s ? s->id : NO_STOP);
+    }
     buses_.push_back(move(bus));
     auto& stored = buses_.back();
-    busname_to_bus_[stored.name] = &stored;
-    for (const auto* s : stored.route) {
-        if (s) {
-            passing_buses_[s->name].insert(&stored);
+    busname_to_bus_.insert_or_assign(pmr::string(name, &arena_counter_), &stored);
+    for (const StopId stop_id : stored.stop_ids) {
+        if (stop_id != NO_STOP) {
+            passing_buses_[stop_id].insert(&stored);
         }
     }
 }
 
 const Stop* TransportCatalogue::FindStop(string_view name) const {
-    auto it = stopname_to_stop_.find(string(name));
-    return it != stopname_to_stop_.end() ? it->second : nullptr;
+    const auto id = FindStopId(name);
+    return id ? &stops_[*id] : nullptr;
 }
 
 const Bus* TransportCatalogue::FindBus(string_view name) const {
-    auto it = busname_to_bus_.find(string(name));
+    auto it = busname_to_bus_.find(name);
     return it != busname_to_bus_.end() ? it->second : nullptr;
 }
 
+optional<StopId> TransportCatalogue::FindStopId(string_view name) const {
+    auto it = stopname_to_id_.find(name);
+    return it != stopname_to_id_.end() ? optional<StopId>(it->second) : nullopt;
+}
+
+optional<BusId> TransportCatalogue::FindBusId(string_view name) const {
+    const Bus* bus = FindBus(name);
+    return bus ? optional<BusId>(bus->id) : nullopt;
+}
+
 void TransportCatalogue::AddLength(pair<string_view, string_view> stops, int length) {
-    const Stop* a = FindStop(stops.first);
-    const Stop* b = FindStop(stops.second);
+    const auto a = FindStopId(stops.first);
+    const auto b = FindStopId(stops.second);
     if (!a || !b) return;
-    distance_between_stops_[{a, b}] = length;
+    AddLength(*a, *b, length);
+}
+
+void TransportCatalogue::AddLength(StopId from, StopId to, int length) {
+    length_offsets_.clear();
+    bus_infos_.clear();
+    distance_between_stops_[MakeStopPairKey(from, to)] = length;
 }
 
 int TransportCatalogue::GetLength(string_view from, string_view to) const {
-    const Stop* a = FindStop(from);
-    const Stop* b = FindStop(to);
+    const auto a = FindStopId(from);
+    const auto b = FindStopId(to);
     if (!a || !b) return 0;
+    return GetLength(*a, *b);
+}
 
-    auto it = distance_between_stops_.find({a, b});
+int TransportCatalogue::GetLength(StopId from, StopId to) const {
+    if (!length_offsets_.empty()) {
+        if (from >= stops_.size()) return 0;
+        const auto first = length_targets_.begin() + length_offsets_[from];
+        const auto last = length_targets_.begin() + length_offsets_[from + 1];
+        const auto target_it = lower_bound(first, last, to);
+        return target_it != last && *target_it == to ? length_values_[target_it - length_targets_.begin()] : 0;
+    }
+
+    auto it = distance_between_stops_.find(MakeStopPairKey(from, to));
     if (it != distance_between_stops_.end()) return it->second;
 
-    auto it2 = distance_between_stops_.find({b, a});
+    auto it2 = distance_between_stops_.find(MakeStopPairKey(to, from));
     if (it2 != distance_between_stops_.end()) return it2->second;
 
     return 0;
 }
 
+void TransportCatalogue::FreezeLengths() {
+    struct Length {
+        StopId from;
+        StopId to;
+        int value;
+    };
+    vector<Length> lengths;
+    lengths.reserve(distance_between_stops_.size() * 2);
+    for (const auto& [key, value] : distance_between_stops_) {
+        const StopId from = static_cast<StopId>(key >> 32);
+        const StopId to = static_cast<StopId>(key);
+        lengths.push_back({from, to, value});
+        if (!distance_between_stops_.count(MakeStopPairKey(to, from))) {
+            lengths.push_back({to, from, value});
+        }
+    }
+    sort(lengths.begin(), lengths.end(), [](const Length& lhs, const Length& rhs) {
+        return lhs.from != rhs.from ? lhs.from < rhs.from : lhs.to < rhs.to;
+    });
+
+    length_offsets_.assign(stops_.size() + 1, 0);
+    length_targets_.clear();
+    length_values_.clear();
+    length_targets_.reserve(lengths.size());
+    length_values_.reserve(lengths.size());
+    for (const Length& length : lengths) {
+        ++length_offsets_[length.from + 1];
+        length_targets_.push_back(length.to);
+        length_values_.push_back(length.value);
+    }
+    for (size_t i = 0; i < stops_.size(); ++i) {
+        length_offsets_[i + 1] += length_offsets_[i];
+    }
+}
+
+void TransportCatalogue::Freeze(size_t thread_count) {
+    FreezeLengths();
+    ComputeBusInfos(thread_count);
+    SortPassingBuses();
+}
+
+void TransportCatalogue::ComputeBusInfos(size_t thread_count) const {
+    vector<BusInfo> bus_infos(buses_.size());
+    parallel::ForEachIndex(buses_.size(), buses_.size() < MIN_PARALLEL_BUS_COUNT ? 1 : thread_count,
+                           [&](size_t bus_id) {
+        bus_infos[bus_id] = ComputeBusInfo(buses_[bus_id]);
+    });
+    bus_infos_ = move(bus_infos);
+}
+
+void TransportCatalogue::SortPassingBuses() const {
+    vector<BusId> name_order(buses_.size());
+    iota(name_order.begin(), name_order.end(), BusId{0});
+    sort(name_order.begin(), name_order.end(), [this](BusId lhs, BusId rhs) {
+        return buses_[lhs].name < buses_[rhs].name;
+    });
+
+    passing_bus_offsets_.assign(stops_.size() + 1, 0);
+    for (StopId stop_id = 0; stop_id < stops_.size(); ++stop_id) {
+        passing_bus_offsets_[stop_id + 1] = passing_bus_offsets_[stop_id]
+                                            + static_cast<uint32_t>(passing_buses_[stop_id].size());
+    }
+    passing_bus_runs_.resize(passing_bus_offsets_.back());
+    // Appending buses in name order leaves every stop's run sorted; a stop
+    // met again on the same route already ends with that bus.
+    vector<uint32_t> next(passing_bus_offsets_.begin(), passing_bus_offsets_.end() - 1);
+    for (const BusId bus_id : name_order) {
+        const Bus* bus = &buses_[bus_id];
+        for (const StopId stop_id : bus->stop_ids) {
+            if (stop_id == NO_STOP
+                || (next[stop_id] > passing_bus_offsets_[stop_id] && passing_bus_runs_[next[stop_id] - 1] == bus)) {
+                continue;
+            }
+            passing_bus_runs_[next[stop_id]++] = bus;
+        }
+    }
+}
+
 const deque<Stop>& TransportCatalogue::GetStops() const {
     return stops_;
 }
@@ -64,40 +185,65 @@ const deque<Bus>& TransportCatalogue::GetBuses() const {
 }
 
 set<Bus*> TransportCatalogue::GetPassingBuses(string_view stop_name) const {
-    auto it = passing_buses_.find(string(stop_name));
-    return it != passing_buses_.end() ? it->second : set<Bus*>{};
+    const auto id = FindStopId(stop_name);
+    return id ? passing_buses_[*id] : set<Bus*>{};
+}
+
+const set<Bus*>& TransportCatalogue::GetPassingBuses(StopId stop_id) const {
+    return passing_buses_.at(stop_id);
+}
+
+BusRange TransportCatalogue::GetSortedPassingBuses(StopId stop_id) const {
+    if (stop_id >= stops_.size()) {
+        throw out_of_range("Stop id is out of range");
+    }
+    if (passing_bus_offsets_.empty()) {
+        SortPassingBuses();
+    }
+    const Bus* const* run = passing_bus_runs_.data();
+    return {run + passing_bus_offsets_[stop_id], run + passing_bus_offsets_[stop_id + 1]};
+}
+
+ArenaStats TransportCatalogue::GetArenaStats() const {
+    return {arena_counter_.GetAllocationCount(), heap_.GetAllocationCount(), heap_.GetByteCount()};
 }
 
 const TransportCatalogue::BusNameToBusMap& TransportCatalogue::GetBusesToFind() const {
     return busname_to_bus_;
 }
 
-optional<BusInfo> TransportCatalogue::GetBusInfo(string_view bus_name) const { 
+const BusInfo* TransportCatalogue::GetBusInfo(string_view bus_name) const { 
     const auto* bus = FindBus(bus_name); 
-    if (!bus) return nullopt; 
+    if (!bus) return nullptr; 
+    if (bus_infos_.empty()) ComputeBusInfos(1); 
+    return &bus_infos_[bus->id]; 
+} 
  
+BusInfo TransportCatalogue::ComputeBusInfo(const Bus& bus) const { 
     BusInfo info; 
-    info.name = bus->name; 
-    info.num_stops = static_cast<int>(bus->route.size()); 
+    info.name = string(bus.name); 
+    info.num_stops = static_cast<int>(bus.route.size()); 
  
-    set<string> unique_stops; 
+    vector<StopId> unique_stops; 
+    unique_stops.reserve(bus.stop_ids.size()); 
     double geo_length = 0.0; 
     int real_length = 0; 
  
-    for (size_t i = 0; i + 1 < bus->route.size(); ++i) { 
-        const auto* a = bus->route[i]; 
-        const auto* b = bus->route[i + 1]; 
+    for (size_t i = 0; i + 1 < bus.route.size(); ++i) { 
+        const auto* a = bus.route[i]; 
+        const auto* b = bus.route[i + 1]; 
         if (!a || !b) continue; 
  
-        unique_stops.insert(a->name); 
+        unique_stops.push_back(a->id); 
         geo_length += geo::ComputeDistance(a->coord, b->coord); 
-        real_length += GetLength(a->name, b->name); 
+        real_length += GetLength(a->id, b->id); 
     } 
  
-    if (!bus->route.empty()) 
-        unique_stops.insert(bus->route.back()->name); 
+    if (!bus.route.empty() && bus.route.back()) 
+        unique_stops.push_back(bus.route.back()->id); 
  
-    info.uniq_stops = static_cast<int>(unique_stops.size()); 
+    sort(unique_stops.begin(), unique_stops.end()); 
+    info.uniq_stops = static_cast<int>(unique(unique_stops.begin(), unique_stops.end()) - unique_stops.begin()); 
     info.length_route = real_length; 
     info.curvature = geo_length > 0.0 ? static_cast<double>(real_length) / geo_length : 0.0; 
  
@@ -2,13 +2,17 @@
 
 #include "geo.h"
 #include "domain.h"
+#include "ranges.h"
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <string_view>
 #include <deque>
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <memory_resource>
 #include <optional>
 #include <set>
 
@@ -26,42 +30,148 @@ namespace transport_catalogue {
         }
     };
 
-    struct StopPtrPairHasher {
-        size_t operator()(const std::pair<const Stop*, const Stop*>& p) const noexcept {
-            auto h1 = reinterpret_cast<size_t>(p.first);
-            auto h2 = reinterpret_cast<size_t>(p.second);
-            return h1 * 17 + h2 * 17 * 17;
+    // Stop ids are below 2^32, so a pair of them packs into one key.
+    inline uint64_t MakeStopPairKey(StopId from, StopId to) {
+        return (static_cast<uint64_t>(from) << 32) | to;
+    }
+
+    // Passes allocations on to upstream and counts them.
+    class CountingResource : public std::pmr::memory_resource {
+    public:
+        explicit CountingResource(std::pmr::memory_resource* upstream)
+            : upstream_(upstream) {
+        }
+
+        size_t GetAllocationCount() const {
+            return allocation_count_;
+        }
+
+        size_t GetByteCount() const {
+            return byte_count_;
+        }
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            ++allocation_count_;
+            byte_count_ += bytes;
+            return upstream_->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+            upstream_->deallocate(ptr, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
         }
+
+        std::pmr::memory_resource* upstream_;
+        size_t allocation_count_ = 0;
+        size_t byte_count_ = 0;
+    };
+
+    struct ArenaStats {
+        // Names and route arrays placed in the arena.
+        size_t allocation_count = 0;
+        // Blocks the arena took from the heap for them.
+        size_t block_count = 0;
+        size_t block_bytes = 0;
     };
 
+    // Stops and buses get dense ids in order of insertion: the id of a stop
+    // is its index in GetStops(), the id of a bus its index in GetBuses().
+    // Name lookups hash the string_view they are given without copying it;
+    // the id-based overloads hash no strings at all.
+    // Names and routes of all stops and buses live in one arena owned by the
+    // catalogue and released with it; they never move once added.
     class TransportCatalogue {
     public:
-        void AddStop(Stop stop);
-        void AddBus(Bus bus);
+        TransportCatalogue() = default;
+        TransportCatalogue(const TransportCatalogue&) = delete;
+        TransportCatalogue& operator=(const TransportCatalogue&) = delete;
+
+        void AddStop(std::string_view name, geo::Coordinates coord);
+        // Missing stops are null in route.
+        void AddBus(std::string_view name, const std::vector<const Stop*>& route, bool is_round_trip);
 
         const Stop* FindStop(std::string_view name) const;
         const Bus* FindBus(std::string_view name) const;
+        std::optional<StopId> FindStopId(std::string_view name) const;
+        std::optional<BusId> FindBusId(std::string_view name) const;
 
         void AddLength(std::pair<std::string_view, std::string_view> stops, int length);
+        void AddLength(StopId from, StopId to, int length);
+        // The distance set from one stop to the other, or else the reverse
+        // one; 0 when neither is known.
         int GetLength(std::string_view from, std::string_view to) const;
+        int GetLength(StopId from, StopId to) const;
+        // Copies the distances into per-stop arrays sorted by destination,
+        // with the reverse distances already filled in where only those are
+        // set, so that GetLength reads one short run of memory. A later
+        // AddStop or AddLength drops the arrays until the next call.
+        void FreezeLengths();
+        // Freezes the lengths, precomputes the BusInfo of every bus, so that
+        // GetBusInfo becomes a lookup, and sorts the buses through every stop
+        // by name. Large catalogues are processed on up to thread_count
+        // threads. A later AddStop, AddBus or AddLength drops the precomputed
+        // data until the next call.
+        void Freeze(size_t thread_count = 1);
 
         const std::deque<Stop>& GetStops() const;
         const std::deque<Bus>& GetBuses() const;
 
         std::set<Bus*> GetPassingBuses(std::string_view stop_name) const;
+        const std::set<Bus*>& GetPassingBuses(StopId stop_id) const;
+        // The buses through the stop, ordered by bus name, pointing into
+        // storage of the catalogue. On a catalogue changed since Freeze
+        // the first call sorts the buses of all stops again, so such calls
+        // must not run concurrently.
+        BusRange GetSortedPassingBuses(StopId stop_id) const;
 
-        using BusNameToBusMap = std::unordered_map<std::string, const Bus*, StringViewHasher>;
+        // Keys are allocated from the arena.
+        using BusNameToBusMap = std::unordered_map<std::pmr::string, const Bus*, StringViewHasher, std::equal_to<>>;
         const BusNameToBusMap& GetBusesToFind() const;
 
-        std::optional<BusInfo> GetBusInfo(std::string_view bus_name) const;
+        // Null for an unknown bus; otherwise points into storage of the
+        // catalogue. On a catalogue changed since Freeze the first call
+        // computes the BusInfo of all buses again, so such calls must not run
+        // concurrently.
+        const BusInfo* GetBusInfo(std::string_view bus_name) const;
+        ArenaStats GetArenaStats() const;
     private:
+        // Fewer buses than this are not worth starting threads for.
+        static constexpr size_t MIN_PARALLEL_BUS_COUNT = 256;
+
+        BusInfo ComputeBusInfo(const Bus& bus) const;
+        void ComputeBusInfos(size_t thread_count) const;
+        void SortPassingBuses() const;
+
+        // Declared first so that the arena outlives everything allocated in it.
+        CountingResource heap_{std::pmr::new_delete_resource()};
+        std::pmr::monotonic_buffer_resource arena_{&heap_};
+        CountingResource arena_counter_{&arena_};
+
         std::deque<Stop> stops_;
         std::deque<Bus> buses_;
 
-        std::unordered_map<std::string, const Stop*, StringViewHasher> stopname_to_stop_;
+        std::unordered_map<std::pmr::string, StopId, StringViewHasher, std::equal_to<>> stopname_to_id_;
         BusNameToBusMap busname_to_bus_;
 
-        std::unordered_map<std::pair<const Stop*, const Stop*>, int, StopPtrPairHasher> distance_between_stops_;
-        std::unordered_map<std::string, std::set<Bus*>, StringViewHasher> passing_buses_;
+        // Keyed by MakeStopPairKey.
+        std::unordered_map<uint64_t, int> distance_between_stops_;
+        // Frozen distances from stop s: length_targets_/length_values_ in
+        // [length_offsets_[s], length_offsets_[s + 1]); empty when not frozen.
+        std::vector<uint32_t> length_offsets_;
+        std::vector<StopId> length_targets_;
+        std::vector<int> length_values_;
+        // Indexed by bus id; empty until computed by Freeze or GetBusInfo.
+        mutable std::vector<BusInfo> bus_infos_;
+        // Indexed by stop id.
+        std::vector<std::set<Bus*>> passing_buses_;
+        // Buses through stop s, by name: passing_bus_runs_ in
+        // [passing_bus_offsets_[s], passing_bus_offsets_[s + 1]); empty until
+        // sorted by Freeze or GetSortedPassingBuses.
+        mutable std::vector<uint32_t> passing_bus_offsets_;
+        mutable std::vector<const Bus*> passing_bus_runs_;
     };
 }
\ No newline at end of file
@@ -4,142 +4,1029 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 
 namespace transport_router {
 
 using namespace std;
 using namespace transport_catalogue;
 
+namespace {
+
+enum SnapshotSection : uint32_t {
+    SNAPSHOT_META = 1,
+    SNAPSHOT_GRAPH_EDGES,
+    SNAPSHOT_EDGE_INFOS,
+    SNAPSHOT_ROUTER_WEIGHTS,
+    SNAPSHOT_ROUTER_PREV_EDGES,
+    SNAPSHOT_HUB_OUT_OFFSETS,
+    SNAPSHOT_HUB_OUT_HUBS,
+    SNAPSHOT_HUB_OUT_WEIGHTS,
+    SNAPSHOT_HUB_IN_OFFSETS,
+    SNAPSHOT_HUB_IN_HUBS,
+    SNAPSHOT_HUB_IN_WEIGHTS
+};
+
+struct SnapshotMeta {
+    uint64_t vertex_count;
+    uint64_t edge_count;
+    uint64_t router_tile;
+};
+
+// Position of (x, y) along a Hilbert curve filling a HILBERT_SIDE^2 grid.
+constexpr uint32_t HILBERT_SIDE = 1u << 16;
+
+uint64_t GetHilbertIndex(uint32_t x, uint32_t y) {
+    uint64_t index = 0;
+    for (uint32_t half = HILBERT_SIDE / 2; half > 0; half /= 2) {
+        const uint32_t right = (x & half) > 0 ? 1 : 0;
+        const uint32_t top = (y & half) > 0 ? 1 : 0;
+        index += static_cast<uint64_t>(half) * half * ((3 * right) ^ top);
+        // Turn the quadrant so that the curve inside it runs the right way.
+        if (top == 0) {
+            if (right == 1) {
+                x = HILBERT_SIDE - 1 - x;
+                y = HILBERT_SIDE - 1 - y;
+            }
+            swap(x, y);
+        }
+    }
+    return index;
+}
+
+void SortByHilbertIndex(vector<const Stop*>& stops) {
+    if (stops.empty()) {
+        return;
+    }
+    double min_lat = stops.front()->coord.lat;
+    double max_lat = min_lat;
+    double min_lng = stops.front()->coord.lng;
+    double max_lng = min_lng;
+    for (const Stop* stop : stops) {
+        min_lat = min(min_lat, stop->coord.lat);
+        max_lat = max(max_lat, stop->coord.lat);
+        min_lng = min(min_lng, stop->coord.lng);
+        max_lng = max(max_lng, stop->coord.lng);
+    }
+    auto to_grid = [](double value, double min_value, double max_value) {
+        if (max_value <= min_value) {
+            return uint32_t{0};
+        }
+        return static_cast<uint32_t>((value - min_value) / (max_value - min_value) * (HILBERT_SIDE - 1));
+    };
+
+    vector<pair<uint64_t, const Stop*>> keyed_stops;
+    keyed_stops.reserve(stops.size());
+    for (const Stop* stop : stops) {
+        keyed_stops.emplace_back(GetHilbertIndex(to_grid(stop->coord.lng, min_lng, max_lng),
+                                                 to_grid(stop->coord.lat, min_lat, max_lat)),
+                                 stop);
+    }
+    stable_sort(keyed_stops.begin(), keyed_stops.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first < rhs.first;
+    });
+    for (size_t i = 0; i < stops.size(); ++i) {
+        stops[i] = keyed_stops[i].second;
+    }
+}
+
+template <typename T>
+vector<T> CopySection(const snapshot::Section& section) {
+    return vector<T>(section.As<T>(), section.As<T>() + section.Count<T>());
+}
+
+// Hub labels of one direction take three sections starting at first_section:
+// offsets, hubs and weights.
+optional<graph::LabelSet<double>> ReadLabelSet(const snapshot::Reader& reader, uint32_t first_section,
+                                               size_t vertex_count) {
+    const auto offsets_section = reader.GetSection(first_section);
+    const auto hubs_section = reader.GetSection(first_section + 1);
+    const auto weights_section = reader.GetSection(first_section + 2);
+    if (!offsets_section || !hubs_section || !weights_section || offsets_section->size % sizeof(uint32_t) != 0
+        || hubs_section->size % sizeof(uint32_t) != 0 || weights_section->size % sizeof(double) != 0) {
+        return nullopt;
+    }
+    graph::LabelSet<double> labels{CopySection<uint32_t>(*offsets_section), CopySection<uint32_t>(*hubs_section),
+                                   CopySection<double>(*weights_section)};
+    if (!labels.IsValid(vertex_count)) {
+        return nullopt;
+    }
+    return labels;
+}
+
+void AddLabelSet(snapshot::Writer& writer, const graph::LabelSet<double>& labels, uint32_t first_section) {
+    writer.AddSection(first_section, labels.offsets.data(), labels.offsets.size() * sizeof(uint32_t), true);
+    writer.AddSection(first_section + 1, labels.hubs.data(), labels.hubs.size() * sizeof(uint32_t), false);
+    writer.AddSection(first_section + 2, labels.weights.data(), labels.weights.size() * sizeof(double), false);
+}
+
+}
+
 TransportRouter::TransportRouter(const TransportCatalogue& catalogue, RoutingSettings settings)
     : catalogue_(catalogue)
-    , settings_(settings) {
+    , settings_(settings)
+    , routed_buses_(catalogue.GetBuses().size(), true)
+    , route_cache_(settings.route_cache_capacity > 0 ? make_unique<RouteCache>(settings.route_cache_capacity)
+                                                     : nullptr) {
+    RegisterStops();
     BuildGraph();
+    BuildRouter();
+    BuildHubLabels();
 }
 
-void TransportRouter::BuildGraph() {
-    const auto& stops = catalogue_.GetStops();
-    const size_t vertex_count = stops.size();
-    
-    graph_ = make_unique<graph::DirectedWeightedGraph<double>>(vertex_count);
-    
-    stop_name_to_vertex_id_.reserve(vertex_count);
-    vertex_id_to_stop_name_.reserve(vertex_count);
+TransportRouter::TransportRouter(const TransportCatalogue& catalogue, RoutingSettings settings,
+                                 const filesystem::path& snapshot_file)
+    : catalogue_(catalogue)
+    , settings_(settings)
+    , routed_buses_(catalogue.GetBuses().size(), true)
+    , route_cache_(settings.route_cache_capacity > 0 ? make_unique<RouteCache>(settings.route_cache_capacity)
+                                                     : nullptr) {
+    RegisterStops();
+    if (!LoadSnapshot(snapshot_file)) {
+        BuildGraph();
+        BuildRouter();
+        BuildHubLabels();
+        // RAPTOR has nothing worth saving.
+        if (graph_) {
+            SaveSnapshot(snapshot_file);
+        }
+    }
+}
+
+void TransportRouter::RegisterStops() {
+    const vector<const Stop*> stops = OrderStops();
+    const size_t stop_count = stops.size();
+
+    stop_id_to_vertex_id_.assign(stop_count, 0);
+    vertex_id_to_stop_name_.clear();
+    vertex_id_to_stop_name_.reserve(stop_count);
 
     graph::VertexId v_id = 0;
-    for (const auto& stop : stops) {
-        stop_name_to_vertex_id_[stop.name] = v_id;
-        vertex_id_to_stop_name_.push_back(stop.name);
+    for (const Stop* stop : stops) {
+        stop_id_to_vertex_id_[stop->id] = v_id;
+        vertex_id_to_stop_name_.push_back(stop->name);
         ++v_id;
     }
+}
+
+optional<graph::VertexId> TransportRouter::FindVertex(string_view stop_name) const {
+    const auto stop_id = catalogue_.FindStopId(stop_name);
+    if (!stop_id || *stop_id >= stop_id_to_vertex_id_.size()) {
+        return nullopt;
+    }
+    return stop_id_to_vertex_id_[*stop_id];
+}
+
+vector<const Stop*> TransportRouter::OrderStops() const {
+    vector<const Stop*> stops;
+    stops.reserve(catalogue_.GetStops().size());
+    for (const auto& stop : catalogue_.GetStops()) {
+        stops.push_back(&stop);
+    }
+    switch (settings_.vertex_order) {
+        case VertexOrder::CATALOGUE:
+            break;
+        case VertexOrder::HILBERT:
+            SortByHilbertIndex(stops);
+            break;
+        case VertexOrder::RCM:
+            stops = OrderStopsByCuthillMcKee(stops);
+            break;
+    }
+    return stops;
+}
 
+vector<const Stop*> TransportRouter::OrderStopsByCuthillMcKee(const vector<const Stop*>& stops) const {
+    // Stops are neighbours when a routed bus goes from one to the other.
+    // stops are in catalogue order here, so stop ids index them.
+    vector<vector<StopId>> neighbours(stops.size());
     const auto& buses = catalogue_.GetBuses();
-    for (const auto& bus : buses) {
-        const auto& route = bus.route;
-        if (route.empty()) continue;
+    for (uint32_t bus_index = 0; bus_index < routed_buses_.size(); ++bus_index) {
+        if (!routed_buses_[bus_index]) {
+            continue;
+        }
+        const auto& stop_ids = buses[bus_index].stop_ids;
+        for (size_t i = 1; i < stop_ids.size(); ++i) {
+            const StopId from = stop_ids[i - 1];
+            const StopId to = stop_ids[i];
+            if (from != to) {
+                neighbours[from].push_back(to);
+                neighbours[to].push_back(from);
+            }
+        }
+    }
+    for (auto& stop_neighbours : neighbours) {
+        sort(stop_neighbours.begin(), stop_neighbours.end());
+        stop_neighbours.erase(unique(stop_neighbours.begin(), stop_neighbours.end()), stop_neighbours.end());
+    }
+    const auto by_degree = [&neighbours](uint32_t lhs, uint32_t rhs) {
+        return neighbours[lhs].size() < neighbours[rhs].size();
+    };
+
+    // Every connected part is walked breadth-first from its least connected
+    // stop, visiting the neighbours of each stop in order of degree.
+    vector<StopId> starts(stops.size());
+    for (StopId i = 0; i < stops.size(); ++i) {
+        starts[i] = i;
+    }
+    stable_sort(starts.begin(), starts.end(), by_degree);
+    vector<bool> is_visited(stops.size(), false);
+    vector<StopId> order;
+    order.reserve(stops.size());
+    vector<StopId> unvisited_neighbours;
+    for (const StopId start : starts) {
+        if (is_visited[start]) {
+            continue;
+        }
+        is_visited[start] = true;
+        order.push_back(start);
+        for (size_t next = order.size() - 1; next < order.size(); ++next) {
+            unvisited_neighbours.clear();
+            for (const uint32_t neighbour : neighbours[order[next]]) {
+                if (!is_visited[neighbour]) {
+                    is_visited[neighbour] = true;
+                    unvisited_neighbours.push_back(neighbour);
+                }
+            }
+            stable_sort(unvisited_neighbours.begin(), unvisited_neighbours.end(), by_degree);
+            order.insert(order.end(), unvisited_neighbours.begin(), unvisited_neighbours.end());
+        }
+    }
+
+    vector<const Stop*> result;
+    result.reserve(stops.size());
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        result.push_back(stops[*it]);
+    }
+    return result;
+}
+
+void TransportRouter::AddBus(string_view bus_name) {
+    const uint32_t bus_index = GetBusIndex(bus_name);
+    routed_buses_.resize(catalogue_.GetBuses().size(), false);
+    if (routed_buses_[bus_index]) {
+        return;
+    }
+    routed_buses_[bus_index] = true;
+
+    const Bus& bus = catalogue_.GetBuses()[bus_index];
+    const bool has_new_stops = any_of(bus.stop_ids.begin(), bus.stop_ids.end(), [this](StopId stop_id) {
+        return stop_id >= stop_id_to_vertex_id_.size();
+    });
+    if (!raptor_ && settings_.graph_model == GraphModel::COMPLETE && !has_new_stops) {
+        const graph::EdgeId first_edge = graph_->GetEdgeCount();
+        AddCompleteBusEdges(bus_index);
+        graph_->Freeze();
+        if (!router_->ApplyAddedEdges(first_edge)) {
+            BuildRouter();
+        }
+        BuildHubLabels();
+    } else {
+        Rebuild();
+    }
+    if (route_cache_) {
+        route_cache_->Clear();
+    }
+}
+
+void TransportRouter::RemoveBus(string_view bus_name) {
+    const uint32_t bus_index = GetBusIndex(bus_name);
+    if (bus_index >= routed_buses_.size() || !routed_buses_[bus_index]) {
+        return;
+    }
+    routed_buses_[bus_index] = false;
+    Rebuild();
+    if (route_cache_) {
+        route_cache_->Clear();
+    }
+}
+
+uint32_t TransportRouter::GetBusIndex(string_view bus_name) const {
+    const optional<BusId> bus_id = catalogue_.FindBusId(bus_name);
+    if (!bus_id) {
+        throw invalid_argument("Unknown bus: "s + string(bus_name));
+    }
+    return *bus_id;
+}
+
+void TransportRouter::Rebuild() {
+    hub_labels_.reset();
+    raptor_.reset();
+    router_.reset();
+    snapshot_.reset();
+    graph_.reset();
+    edge_infos_.clear();
+    RegisterStops();
+    BuildGraph();
+    BuildRouter();
+    BuildHubLabels();
+}
+
+void TransportRouter::BuildGraph() {
+    if (settings_.router_type == RouterType::RAPTOR) {
+        return;
+    }
+    switch (settings_.graph_model) {
+        case GraphModel::COMPLETE:
+            BuildCompleteGraph();
+            break;
+        case GraphModel::SPLIT:
+            BuildSplitGraph();
+            break;
+    }
+    if (settings_.prune_parallel_edges) {
+        PruneParallelEdges();
+    }
+    graph_->Freeze();
+}
+
+void TransportRouter::BuildRouter() {
+    if (settings_.router_type == RouterType::RAPTOR) {
+        router_type_ = RouterType::RAPTOR;
+        BuildRaptorRouter();
+        return;
+    }
+    router_type_ = ResolveRouterType(graph_->GetVertexCount(), graph_->GetEdgeCount());
+    switch (router_type_) {
+        case RouterType::ALL_PAIRS:
+            VisitTableLayout(graph_->GetEdgeCount(), [this](auto table_weight, auto edge_index) {
+                using AllPairsRouter = graph::Router<double, decltype(table_weight), decltype(edge_index)>;
+                router_ = make_unique<AllPairsRouter>(*graph_, settings_.thread_count);
+            });
+            break;
+        case RouterType::DIJKSTRA:
+            router_ = make_unique<graph::DijkstraRouter<double>>(*graph_);
+            break;
+        case RouterType::CONTRACTION_HIERARCHY:
+            router_ = make_unique<graph::ContractionHierarchy<double>>(*graph_);
+            break;
+        case RouterType::BIDIRECTIONAL_DIJKSTRA:
+            router_ = make_unique<graph::BidirectionalRouter<double>>(*graph_);
+            break;
+        case RouterType::ALT:
+            router_ = make_unique<graph::BidirectionalRouter<double>>(*graph_, settings_.landmark_count);
+            break;
+        case RouterType::RAPTOR:
+        case RouterType::AUTO:
+            throw logic_error("Router type should be resolved before building");
+    }
+}
 
-        auto add_route_edges = [&](const std::vector<const Stop*>& sequence) {
+void TransportRouter::BuildRaptorRouter() {
+    raptor_ = make_unique<RaptorRouter>(vertex_id_to_stop_name_.size(), settings_.bus_wait_time,
+                                        settings_.bus_velocity);
+    const auto& buses = catalogue_.GetBuses();
+    vector<graph::VertexId> stops;
+    vector<int64_t> distances;
+    for (uint32_t bus_index = 0; bus_index < routed_buses_.size(); ++bus_index) {
+        if (!routed_buses_[bus_index]) {
+            continue;
+        }
+        ForEachStopSequence(buses[bus_index], [&](const std::pmr::vector<StopId>& sequence) {
+            stops.clear();
+            distances.clear();
+            int64_t distance = 0;
             for (size_t i = 0; i < sequence.size(); ++i) {
-                double current_dist_sum = 0.0;
-                int span_count = 0;
+                if (i > 0) {
+                    distance += catalogue_.GetLength(sequence[i - 1], sequence[i]);
+                }
+                stops.push_back(stop_id_to_vertex_id_[sequence[i]]);
+                distances.push_back(distance);
+            }
+            raptor_->AddSequence(bus_index, stops, distances);
+        });
+    }
+    raptor_->Freeze();
+}
 
-                for (size_t j = i + 1; j < sequence.size(); ++j) {
-                    const Stop* from_stop = sequence[j - 1];
-                    const Stop* to_stop = sequence[j];
+void TransportRouter::BuildHubLabels() {
+    if (settings_.hub_labels && graph_) {
+        hub_labels_ = make_unique<graph::HubLabels<double>>(*graph_);
+    } else {
+        hub_labels_.reset();
+    }
+}
 
-                    current_dist_sum += catalogue_.GetLength(from_stop->name, to_stop->name);
-                    span_count++;
+template <typename Callback>
+void TransportRouter::VisitTableLayout(size_t edge_count, Callback callback) const {
+    if (settings_.table_precision == TablePrecision::FLOAT) {
+        // The largest index value marks a missing predecessor.
+        if (edge_count <= numeric_limits<uint16_t>::max()) {
+            callback(float{}, uint16_t{});
+            return;
+        }
+        if (edge_count <= numeric_limits<uint32_t>::max()) {
+            callback(float{}, uint32_t{});
+            return;
+        }
+    }
+    callback(double{}, graph::EdgeId{});
+}
+
+// Linear models fitted to build and query times measured on sample networks
+// of up to 26k vertices and 3.6M edges; they only have to rank the routers.
+// A search costs about 3 ns per edge and 40 ns per vertex. Contraction
+// slows down quadratically with the average degree.
+vector<RouterEstimate> TransportRouter::EstimateRouters(size_t vertex_count, size_t edge_count) const {
+    const double vertices = static_cast<double>(vertex_count);
+    const double edges = static_cast<double>(edge_count);
+    const double average_degree = vertex_count > 0 ? edges / vertices : 0.0;
+    const double search_ns = 3.0 * edges + 40.0 * vertices;
+    const double search_bytes = 50.0 * vertices;
+    const double bidirectional_bytes = 2.0 * search_bytes + 24.0 * edges + 8.0 * vertices;
+    const double table_cells = static_cast<double>(graph::Router<double>::GetTableSize(vertex_count));
+    double table_cell_bytes = 0.0;
+    VisitTableLayout(edge_count, [&table_cell_bytes](auto table_weight, auto edge_index) {
+        table_cell_bytes = sizeof(table_weight) + sizeof(edge_index);
+    });
+    const double landmarks = static_cast<double>(settings_.landmark_count);
+
+    auto make_estimate = [](RouterType type, double bytes, double build_ns, double query_ns) {
+        return RouterEstimate{type, bytes / (1024.0 * 1024.0), build_ns / 1e6, query_ns / 1e3};
+    };
+    return {
+        make_estimate(RouterType::ALL_PAIRS, table_cell_bytes * table_cells,
+                      0.5 * vertices * vertices * vertices / settings_.thread_count, 1000.0),
+        make_estimate(RouterType::DIJKSTRA, search_bytes, edges, search_ns),
+        make_estimate(RouterType::CONTRACTION_HIERARCHY, 72.0 * edges + 100.0 * vertices,
+                      2000.0 * edges * average_degree + 100'000.0 * vertices, 0.5 * search_ns),
+        make_estimate(RouterType::BIDIRECTIONAL_DIJKSTRA, bidirectional_bytes, 3.0 * edges, 0.5 * search_ns),
+        make_estimate(RouterType::ALT, bidirectional_bytes + 16.0 * vertices * landmarks,
+                      3.0 * edges + 2.0 * landmarks * search_ns, 0.3 * search_ns),
+    };
+}
+
+RouterType TransportRouter::ResolveRouterType(size_t vertex_count, size_t edge_count) const {
+    if (settings_.router_type != RouterType::AUTO) {
+        return settings_.router_type;
+    }
+    const auto estimates = EstimateRouters(vertex_count, edge_count);
+    const auto total_ms = [this](const RouterEstimate& estimate) {
+        return estimate.build_ms + settings_.expected_query_count * estimate.query_us / 1000.0;
+    };
+    // The smallest one when nothing fits.
+    const RouterEstimate* best = &*min_element(estimates.begin(), estimates.end(),
+                                               [](const RouterEstimate& lhs, const RouterEstimate& rhs) {
+        return lhs.memory_mb < rhs.memory_mb;
+    });
+    const RouterEstimate* cheapest = nullptr;
+    for (const auto& estimate : estimates) {
+        const bool fits = settings_.max_router_memory_mb == 0
+                          || estimate.memory_mb <= static_cast<double>(settings_.max_router_memory_mb);
+        if (fits && (!cheapest || total_ms(estimate) < total_ms(*cheapest))) {
+            cheapest = &estimate;
+        }
+    }
+    return (cheapest ? cheapest : best)->type;
+}
 
-                    double travel_time = (current_dist_sum / 1000.0) / settings_.bus_velocity * 60.0;
-                    
-                    double total_weight = settings_.bus_wait_time + travel_time;
+template <typename Callback>
+void TransportRouter::ForEachStopSequence(const Bus& bus, Callback callback) {
+    const auto& route = bus.stop_ids;
+    if (route.empty()) return;
+
+    callback(route);
+    // Linear routes are already stored there and back, so their reverse is
+    // usually the route itself and would only duplicate edges.
+    if (!bus.is_round_trip && !equal(route.begin(), route.end(), route.rbegin())) {
+        callback(std::pmr::vector<StopId>(route.rbegin(), route.rend()));
+    }
+}
 
-                    graph::VertexId from_id = stop_name_to_vertex_id_.at(sequence[i]->name);
-                    graph::VertexId to_id = stop_name_to_vertex_id_.at(sequence[j]->name);
-                    
-                    graph::EdgeId edge_id = graph_->AddEdge({from_id, to_id, total_weight});
+void TransportRouter::BuildCompleteGraph() {
+    graph_ = make_unique<graph::DirectedWeightedGraph<double>>(vertex_id_to_stop_name_.size());
 
-                    if (edge_id >= edge_infos_.size()) {
-                        edge_infos_.resize(edge_id + 1);
-                    }
-                    edge_infos_[edge_id] = {bus.name, travel_time, span_count};
+    for (uint32_t bus_index = 0; bus_index < routed_buses_.size(); ++bus_index) {
+        if (routed_buses_[bus_index]) {
+            AddCompleteBusEdges(bus_index);
+        }
+    }
+}
+
+void TransportRouter::AddCompleteBusEdges(uint32_t bus_index) {
+    const Bus& bus = catalogue_.GetBuses()[bus_index];
+    ForEachStopSequence(bus, [&](const std::pmr::vector<StopId>& sequence) {
+        if (sequence.size() > numeric_limits<uint16_t>::max()) {
+            throw length_error("Bus route is too long: "s + string(bus.name));
+        }
+        // Each segment is looked up once; the distance between any two
+        // positions is a difference of these sums.
+        vector<int64_t> distances(sequence.size(), 0);
+        for (size_t j = 1; j < sequence.size(); ++j) {
+            distances[j] = distances[j - 1] + catalogue_.GetLength(sequence[j - 1], sequence[j]);
+        }
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            uint16_t span_count = 0;
+
+            for (size_t j = i + 1; j < sequence.size(); ++j) {
+                const int64_t current_dist_sum = distances[j] - distances[i];
+                if (current_dist_sum > numeric_limits<uint32_t>::max()) {
+                    throw length_error("Bus route is too long: "s + string(bus.name));
                 }
+                span_count++;
+
+                double travel_time = ComputeTravelTime(static_cast<double>(current_dist_sum));
+                double total_weight = settings_.bus_wait_time + travel_time;
+
+                graph::VertexId from_id = stop_id_to_vertex_id_[sequence[i]];
+                graph::VertexId to_id = stop_id_to_vertex_id_[sequence[j]];
+
+                AddEdge({from_id, to_id, total_weight},
+                        {bus_index, static_cast<uint32_t>(current_dist_sum), span_count, EdgeType::BUS});
             }
-        };
+        }
+    });
+}
 
-        if (bus.is_round_trip) {
-            add_route_edges(route);
-        } else {
-            add_route_edges(route);
-            
-            if (!route.empty()) {
-                std::vector<const Stop*> backward_route = route;
-                std::reverse(backward_route.begin(), backward_route.end());
-                add_route_edges(backward_route);
+void TransportRouter::BuildSplitGraph() {
+    // Every stop keeps its waiting vertex (ids 0..stop_count-1); every position
+    // of every bus sequence gets its own on-board vertex after them, so that
+    // riding on through a stop never looks like a transfer.
+    const auto& buses = catalogue_.GetBuses();
+    size_t vertex_count = vertex_id_to_stop_name_.size();
+    for (uint32_t bus_index = 0; bus_index < routed_buses_.size(); ++bus_index) {
+        if (!routed_buses_[bus_index]) {
+            continue;
+        }
+        ForEachStopSequence(buses[bus_index], [&](const std::pmr::vector<StopId>& sequence) {
+            vertex_count += sequence.size();
+        });
+    }
+    graph_ = make_unique<graph::DirectedWeightedGraph<double>>(vertex_count);
+
+    graph::VertexId next_vertex = vertex_id_to_stop_name_.size();
+    for (uint32_t bus_index = 0; bus_index < routed_buses_.size(); ++bus_index) {
+        if (!routed_buses_[bus_index]) {
+            continue;
+        }
+        ForEachStopSequence(buses[bus_index], [&](const std::pmr::vector<StopId>& sequence) {
+            const graph::VertexId first_on_board = next_vertex;
+            next_vertex += sequence.size();
+
+            for (size_t i = 0; i < sequence.size(); ++i) {
+                const graph::VertexId wait_id = stop_id_to_vertex_id_[sequence[i]];
+                const graph::VertexId on_board_id = first_on_board + i;
+
+                if (i + 1 < sequence.size()) {
+                    AddEdge({wait_id, on_board_id, static_cast<double>(settings_.bus_wait_time)},
+                            {bus_index, 0, 0, EdgeType::WAIT});
+
+                    const int length = catalogue_.GetLength(sequence[i], sequence[i + 1]);
+                    const double travel_time = ComputeTravelTime(length);
+                    AddEdge({on_board_id, on_board_id + 1, travel_time},
+                            {bus_index, static_cast<uint32_t>(length), 1, EdgeType::RIDE});
+                }
+                if (i > 0) {
+                    AddEdge({on_board_id, wait_id, 0.0}, {bus_index, 0, 0, EdgeType::ALIGHT});
+                }
+            }
+        });
+    }
+}
+
+void TransportRouter::PruneParallelEdges() {
+    const vector<graph::EdgeId> kept_edge_ids = graph_->RemoveDominatedEdges();
+    vector<GraphEdgeInfo> edge_infos;
+    edge_infos.reserve(kept_edge_ids.size());
+    for (const graph::EdgeId edge_id : kept_edge_ids) {
+        edge_infos.push_back(edge_infos_[edge_id]);
+    }
+    edge_infos_ = std::move(edge_infos);
+}
+
+void TransportRouter::AddEdge(const graph::Edge<double>& edge, GraphEdgeInfo info) {
+    graph::EdgeId edge_id = graph_->AddEdge(edge);
+    if (edge_id >= edge_infos_.size()) {
+        edge_infos_.resize(edge_id + 1);
+    }
+    edge_infos_[edge_id] = std::move(info);
+}
+
+double TransportRouter::ComputeTravelTime(double distance) const {
+    return transport_router::ComputeTravelTime(distance, settings_.bus_velocity);
+}
+
+double TransportRouter::GetTravelTime(graph::EdgeId edge_id) const {
+    const GraphEdgeInfo& info = edge_infos_[edge_id];
+    if (info.type != EdgeType::BUS && info.type != EdgeType::RIDE) {
+        return 0.0;
+    }
+    return ComputeTravelTime(static_cast<double>(info.distance));
+}
+
+uint64_t TransportRouter::ComputeSettingsHash() const {
+    snapshot::Hasher hasher;
+    hasher.AddValue(settings_.bus_wait_time);
+    hasher.AddValue(settings_.bus_velocity);
+    hasher.AddValue(settings_.router_type);
+    hasher.AddValue(settings_.graph_model);
+    hasher.AddValue(settings_.vertex_order);
+    hasher.AddValue(settings_.prune_parallel_edges);
+    hasher.AddValue(settings_.table_precision);
+    hasher.AddValue(settings_.hub_labels);
+    return hasher.Get();
+}
+
+uint64_t TransportRouter::ComputeCatalogueHash() const {
+    // Covers everything the graph is built from: stop order, bus routes and
+    // the road distances along them.
+    snapshot::Hasher hasher;
+    for (const auto& stop : catalogue_.GetStops()) {
+        hasher.AddString(stop.name);
+        hasher.AddValue(stop.coord.lat);
+        hasher.AddValue(stop.coord.lng);
+    }
+    for (const auto& bus : catalogue_.GetBuses()) {
+        hasher.AddString(bus.name);
+        hasher.AddValue(bus.is_round_trip);
+        hasher.AddValue(bus.route.size());
+        for (size_t i = 0; i < bus.route.size(); ++i) {
+            hasher.AddString(bus.route[i]->name);
+            if (i > 0) {
+                hasher.AddValue(catalogue_.GetLength(bus.stop_ids[i - 1], bus.stop_ids[i]));
+                hasher.AddValue(catalogue_.GetLength(bus.stop_ids[i], bus.stop_ids[i - 1]));
             }
         }
     }
+    return hasher.Get();
+}
+
+bool TransportRouter::LoadSnapshot(const filesystem::path& snapshot_file) {
+    if (settings_.router_type == RouterType::RAPTOR) {
+        return false;
+    }
+    auto reader = snapshot::Reader::Open(snapshot_file, ComputeSettingsHash(), ComputeCatalogueHash());
+    if (!reader) {
+        return false;
+    }
+    const auto meta_section = reader->GetSection(SNAPSHOT_META);
+    const auto edges_section = reader->GetSection(SNAPSHOT_GRAPH_EDGES);
+    const auto infos_section = reader->GetSection(SNAPSHOT_EDGE_INFOS);
+    if (!meta_section || meta_section->size != sizeof(SnapshotMeta) || !edges_section || !infos_section) {
+        return false;
+    }
+    const SnapshotMeta& meta = *meta_section->As<SnapshotMeta>();
+    if (edges_section->size != meta.edge_count * sizeof(graph::Edge<double>)
+        || infos_section->size != meta.edge_count * sizeof(GraphEdgeInfo)) {
+        return false;
+    }
 
-    router_ = make_unique<graph::Router<double>>(*graph_);
+    const auto* edges = edges_section->As<graph::Edge<double>>();
+    const auto* infos = infos_section->As<GraphEdgeInfo>();
+    const auto& buses = catalogue_.GetBuses();
+    for (size_t i = 0; i < meta.edge_count; ++i) {
+        if (edges[i].from >= meta.vertex_count || edges[i].to >= meta.vertex_count
+            || infos[i].bus_index >= buses.size() || infos[i].type > EdgeType::ALIGHT) {
+            return false;
+        }
+    }
+
+    optional<snapshot::Section> weights_section;
+    optional<snapshot::Section> prev_edges_section;
+    router_type_ = ResolveRouterType(meta.vertex_count, meta.edge_count);
+    if (router_type_ == RouterType::ALL_PAIRS) {
+        size_t weight_size = 0;
+        size_t edge_index_size = 0;
+        VisitTableLayout(meta.edge_count, [&](auto table_weight, auto edge_index) {
+            weight_size = sizeof(table_weight);
+            edge_index_size = sizeof(edge_index);
+        });
+        const size_t table_size = graph::Router<double>::GetTableSize(meta.vertex_count);
+        weights_section = reader->GetSection(SNAPSHOT_ROUTER_WEIGHTS);
+        prev_edges_section = reader->GetSection(SNAPSHOT_ROUTER_PREV_EDGES);
+        if (meta.router_tile != graph::Router<double>::TILE || !weights_section || !prev_edges_section
+            || weights_section->size != table_size * weight_size
+            || prev_edges_section->size != table_size * edge_index_size) {
+            return false;
+        }
+    }
+
+    optional<graph::LabelSet<double>> out_labels;
+    optional<graph::LabelSet<double>> in_labels;
+    if (settings_.hub_labels) {
+        out_labels = ReadLabelSet(*reader, SNAPSHOT_HUB_OUT_OFFSETS, meta.vertex_count);
+        in_labels = ReadLabelSet(*reader, SNAPSHOT_HUB_IN_OFFSETS, meta.vertex_count);
+        if (!out_labels || !in_labels) {
+            return false;
+        }
+    }
+
+    graph_ = make_unique<graph::DirectedWeightedGraph<double>>(meta.vertex_count);
+    for (size_t i = 0; i < meta.edge_count; ++i) {
+        graph_->AddEdge(edges[i]);
+    }
+    edge_infos_.assign(infos, infos + meta.edge_count);
+    graph_->Freeze();
+
+    if (router_type_ == RouterType::ALL_PAIRS) {
+        VisitTableLayout(meta.edge_count, [&](auto table_weight, auto edge_index) {
+            using TableWeight = decltype(table_weight);
+            using EdgeIndex = decltype(edge_index);
+            router_ = make_unique<graph::Router<double, TableWeight, EdgeIndex>>(
+                *graph_, weights_section->As<TableWeight>(), prev_edges_section->As<EdgeIndex>());
+        });
+        snapshot_ = make_unique<snapshot::Reader>(std::move(*reader));
+    } else {
+        BuildRouter();
+    }
+    if (settings_.hub_labels) {
+        hub_labels_ = make_unique<graph::HubLabels<double>>(std::move(*out_labels), std::move(*in_labels));
+    }
+    return true;
+}
+
+void TransportRouter::SaveSnapshot(const filesystem::path& snapshot_file) const {
+    const SnapshotMeta meta{graph_->GetVertexCount(), graph_->GetEdgeCount(), graph::Router<double>::TILE};
+    vector<graph::Edge<double>> edges;
+    edges.reserve(meta.edge_count);
+    for (graph::EdgeId edge_id = 0; edge_id < meta.edge_count; ++edge_id) {
+        edges.push_back(graph_->GetEdge(edge_id));
+    }
+
+    snapshot::Writer writer;
+    writer.AddSection(SNAPSHOT_META, &meta, sizeof(meta), true);
+    writer.AddSection(SNAPSHOT_GRAPH_EDGES, edges.data(), edges.size() * sizeof(edges[0]), true);
+    writer.AddSection(SNAPSHOT_EDGE_INFOS, edge_infos_.data(), edge_infos_.size() * sizeof(GraphEdgeInfo), true);
+    VisitTableLayout(meta.edge_count, [&](auto table_weight, auto edge_index) {
+        using AllPairsRouter = graph::Router<double, decltype(table_weight), decltype(edge_index)>;
+        if (const auto* router = dynamic_cast<const AllPairsRouter*>(router_.get())) {
+            const size_t table_size = AllPairsRouter::GetTableSize(meta.vertex_count);
+            // Left unchecked so that loading stays a lazy page-in; TraceRoute
+            // checks every predecessor it reads instead.
+            writer.AddSection(SNAPSHOT_ROUTER_WEIGHTS, router->GetWeights(), table_size * sizeof(table_weight),
+                              false);
+            writer.AddSection(SNAPSHOT_ROUTER_PREV_EDGES, router->GetPrevEdges(), table_size * sizeof(edge_index),
+                              false);
+        }
+    });
+    if (hub_labels_) {
+        AddLabelSet(writer, hub_labels_->GetOutLabels(), SNAPSHOT_HUB_OUT_OFFSETS);
+        AddLabelSet(writer, hub_labels_->GetInLabels(), SNAPSHOT_HUB_IN_OFFSETS);
+    }
+    // The snapshot only saves the next run a rebuild, so failing to write it
+    // does not stop this one.
+    try {
+        writer.Save(snapshot_file, ComputeSettingsHash(), ComputeCatalogueHash());
+    } catch (const exception& e) {
+        cerr << "Snapshot is not saved: " << e.what() << endl;
+    }
 }
 
 std::optional<json::Node> TransportRouter::FindRoute(const std::string& from, const std::string& to, int request_id) const {
-    if (stop_name_to_vertex_id_.count(from) == 0 || stop_name_to_vertex_id_.count(to) == 0) {
-        return std::nullopt;
+    const auto route = FindRoutes(from, {to}).front();
+    if (!route) {
+        return nullopt;
     }
+    stringstream answer;
+    PrintRoute(*route, request_id, answer);
+    return json::Load(answer).GetRoot();
+}
 
-    graph::VertexId from_id = stop_name_to_vertex_id_.at(from);
-    graph::VertexId to_id = stop_name_to_vertex_id_.at(to);
+optional<double> TransportRouter::FindRouteTime(const std::string& from, const std::string& to) const {
+    const auto from_id = FindVertex(from);
+    const auto to_id = FindVertex(to);
+    if (!from_id || !to_id) {
+        return nullopt;
+    }
+    if (*from_id == *to_id) {
+        return 0.0;
+    }
+    if (hub_labels_) {
+        return hub_labels_->ComputeWeight(*from_id, *to_id);
+    }
+
+    optional<double> time;
+    const auto take_time = [&time](size_t, const vector<optional<double>>& times) {
+        time = times.front();
+    };
+    if (raptor_) {
+        raptor_->ComputeTimes({*from_id}, {*to_id}, take_time);
+    } else {
+        router_->ComputeWeights({*from_id}, {*to_id}, take_time);
+    }
+    return time;
+}
 
-    if (from_id == to_id) {
-        return json::Builder{}
+vector<shared_ptr<const TransportRouter::FoundRoute>> TransportRouter::FindRoutes(
+        const string& from, const vector<string>& destinations) const {
+    vector<shared_ptr<const FoundRoute>> routes(destinations.size());
+    const auto from_vertex = FindVertex(from);
+    if (!from_vertex) {
+        return routes;
+    }
+    const graph::VertexId from_id = *from_vertex;
+
+    // Destinations missing from the cache are searched for together.
+    vector<size_t> pending_indices;
+    vector<graph::VertexId> pending_vertices;
+    for (size_t i = 0; i < destinations.size(); ++i) {
+        const auto to_vertex = FindVertex(destinations[i]);
+        if (!to_vertex) {
+            continue;
+        }
+        const graph::VertexId to_id = *to_vertex;
+        if (to_id == from_id) {
+            routes[i] = MakeFoundRoute(0.0, {});
+            continue;
+        }
+        if (route_cache_) {
+            if (auto cached = route_cache_->Get({from_id, to_id})) {
+                routes[i] = std::move(*cached);
+                continue;
+            }
+        }
+        pending_indices.push_back(i);
+        pending_vertices.push_back(to_id);
+    }
+
+    if (!pending_vertices.empty()) {
+        vector<shared_ptr<const FoundRoute>> found_routes;
+        found_routes.reserve(pending_vertices.size());
+        if (raptor_) {
+            for (auto& journey : raptor_->FindJourneys(from_id, pending_vertices)) {
+                found_routes.push_back(journey ? MakeFoundRoute(journey->total_time, journey->legs) : nullptr);
+            }
+        } else {
+            for (auto& route : router_->BuildRoutes(from_id, pending_vertices)) {
+                found_routes.push_back(route ? MakeFoundRoute(route->weight, MakeRouteLegs(*route)) : nullptr);
+            }
+        }
+        for (size_t k = 0; k < pending_indices.size(); ++k) {
+            routes[pending_indices[k]] = found_routes[k];
+            if (route_cache_) {
+                route_cache_->Put({from_id, pending_vertices[k]}, found_routes[k]);
+            }
+        }
+    }
+    return routes;
+}
+
+void TransportRouter::PrintRoute(const FoundRoute& route, int request_id, ostream& output) {
+    // Keys in the order json::Print gives a Dict.
+    output << "{\"items\":" << route.items << ",\"request_id\":" << request_id << ",\"total_time\":";
+    json::PrintNode{output}(route.total_time);
+    output << '}';
+}
+
+std::optional<json::Node> TransportRouter::FindReachableStops(const std::string& from, double max_time,
+                                                              int request_id) const {
+    const auto from_id = FindVertex(from);
+    if (!from_id) {
+        return std::nullopt;
+    }
+
+    const auto reachable = raptor_ ? raptor_->FindReachableStops(*from_id, max_time)
+                                   : graph::FindReachableVertices(*graph_, *from_id, max_time);
+    json::Array stops;
+    for (const auto& [vertex, time] : reachable) {
+        // On-board vertices of the split model are not stops.
+        if (vertex >= vertex_id_to_stop_name_.size()) {
+            continue;
+        }
+        stops.push_back(json::Builder{}
             .StartDict()
-                .Key("request_id").Value(request_id)
-                .Key("total_time").Value(0.0)
-                .Key("items").StartArray().EndArray()
+                .Key("stop_name").Value(std::string(vertex_id_to_stop_name_[vertex]))
+                .Key("time").Value(time)
             .EndDict()
-            .Build();
+            .Build()
+        );
     }
 
-    auto route_info = router_->BuildRoute(from_id, to_id);
+    return json::Builder{}
+        .StartDict()
+            .Key("request_id").Value(request_id)
+            .Key("stops").Value(std::move(stops))
+        .EndDict()
+        .Build();
+}
 
-    if (!route_info) {
-        return std::nullopt;
+void TransportRouter::ComputeTravelTimes(
+        const std::vector<std::string>& origins, const std::vector<std::string>& destinations,
+        const std::function<void(const std::vector<std::optional<double>>&)>& on_row) const {
+    // Only known stops go to the engine; the rest stay empty.
+    vector<size_t> origin_indices;
+    vector<graph::VertexId> sources;
+    for (size_t i = 0; i < origins.size(); ++i) {
+        if (const auto vertex = FindVertex(origins[i])) {
+            origin_indices.push_back(i);
+            sources.push_back(*vertex);
+        }
+    }
+    vector<size_t> destination_indices;
+    vector<graph::VertexId> targets;
+    for (size_t j = 0; j < destinations.size(); ++j) {
+        if (const auto vertex = FindVertex(destinations[j])) {
+            destination_indices.push_back(j);
+            targets.push_back(*vertex);
+        }
     }
 
-    json::Array items;
-    double total_time = route_info->weight;
+    vector<optional<double>> row(destinations.size());
+    const vector<optional<double>> empty_row(destinations.size());
+    size_t next_origin = 0;
+    const auto handle_row = [&](size_t i, const vector<optional<double>>& weights) {
+        for (; next_origin < origin_indices[i]; ++next_origin) {
+            on_row(empty_row);
+        }
+        for (size_t k = 0; k < targets.size(); ++k) {
+            row[destination_indices[k]] = weights[k];
+        }
+        on_row(row);
+        ++next_origin;
+    };
+    if (hub_labels_) {
+        vector<optional<double>> weights(targets.size());
+        for (size_t i = 0; i < sources.size(); ++i) {
+            for (size_t k = 0; k < targets.size(); ++k) {
+                weights[k] = hub_labels_->ComputeWeight(sources[i], targets[k]);
+            }
+            handle_row(i, weights);
+        }
+    } else if (raptor_) {
+        raptor_->ComputeTimes(sources, targets, handle_row);
+    } else {
+        router_->ComputeWeights(sources, targets, handle_row);
+    }
+    for (; next_origin < origins.size(); ++next_origin) {
+        on_row(empty_row);
+    }
+}
 
-    for (graph::EdgeId edge_id : route_info->edges) {
+vector<RouteLeg> TransportRouter::MakeRouteLegs(const graph::RouteInfo<double>& route) const {
+    vector<RouteLeg> legs;
+    // Consecutive RIDE edges of the split model are one leg, started by the
+    // WAIT edge and closed by the ALIGHT edge.
+    for (graph::EdgeId edge_id : route.edges) {
         const auto& edge = graph_->GetEdge(edge_id);
         const auto& info = edge_infos_.at(edge_id);
-        
+
+        switch (info.type) {
+            case EdgeType::BUS:
+                legs.push_back({edge.from, info.bus_index, info.span_count, GetTravelTime(edge_id)});
+                break;
+            case EdgeType::WAIT:
+                legs.push_back({edge.from, info.bus_index, 0, 0.0});
+                break;
+            case EdgeType::RIDE:
+                legs.back().span_count += info.span_count;
+                legs.back().travel_time += GetTravelTime(edge_id);
+                break;
+            case EdgeType::ALIGHT:
+                break;
+        }
+    }
+    return legs;
+}
+
+shared_ptr<const TransportRouter::FoundRoute> TransportRouter::MakeFoundRoute(
+        double total_time, const vector<RouteLeg>& legs) const {
+    const auto& buses = catalogue_.GetBuses();
+    json::Array items;
+    for (const RouteLeg& leg : legs) {
         items.push_back(json::Builder{}
             .StartDict()
                 .Key("type").Value("Wait")
-                .Key("stop_name").Value(std::string(vertex_id_to_stop_name_[edge.from]))
+                .Key("stop_name").Value(std::string(vertex_id_to_stop_name_[leg.board_stop]))
                 .Key("time").Value(settings_.bus_wait_time)
             .EndDict()
             .Build()
         );
-
         items.push_back(json::Builder{}
             .StartDict()
                 .Key("type").Value("Bus")
-                .Key("bus").Value(info.bus_name)
-                .Key("span_count").Value(info.span_count)
-                .Key("time").Value(info.travel_time)
+                .Key("bus").Value(string(buses[leg.bus_index].name))
+                .Key("span_count").Value(leg.span_count)
+                .Key("time").Value(leg.travel_time)
             .EndDict()
             .Build()
         );
     }
 
-    return json::Builder{}
-        .StartDict()
-            .Key("request_id").Value(request_id)
-            .Key("total_time").Value(total_time)
-            .Key("items").Value(std::move(items))
-        .EndDict()
-        .Build();
+    // Printed once here; answering from the cache only copies the text.
+    ostringstream printed_items;
+    json::Print(json::Document(json::Node(std::move(items))), printed_items);
+    return make_shared<FoundRoute>(FoundRoute{total_time, printed_items.str()});
+}
+
+cache::CacheStats TransportRouter::GetRouteCacheStats() const {
+    return route_cache_ ? route_cache_->GetStats() : cache::CacheStats{};
+}
+
+graph::SearchStats TransportRouter::GetSearchStats() const {
+    return raptor_ ? raptor_->GetSearchStats() : router_->GetSearchStats();
+}
+
+RouterType TransportRouter::GetRouterType() const {
+    return router_type_;
+}
+
+vector<RouterEstimate> TransportRouter::EstimateRouters() const {
+    if (!graph_) {
+        return {};
+    }
+    return EstimateRouters(graph_->GetVertexCount(), graph_->GetEdgeCount());
 }
 
 }
@@ -2,49 +2,258 @@
 
 #include "transport_catalogue.h"
 #include "router.h"
+#include "dijkstra_router.h"
+#include "bidirectional_router.h"
+#include "contraction_hierarchy.h"
+#include "raptor_router.h"
+#include "hub_labels.h"
 #include "graph.h"
 #include "json.h"
 #include "json_builder.h"
+#include "snapshot.h"
+#include "lru_cache.h"
 
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
 #include <memory>
-#include <unordered_map>
 #include <vector>
 #include <string>
 
 namespace transport_router {
 
+// ALL_PAIRS precomputes every route at startup (O(V^3) time, O(V^2) memory)
+// and answers in O(route length); DIJKSTRA starts in O(V + E) and searches
+// on each request; CONTRACTION_HIERARCHY spends some preprocessing on
+// shortcuts (memory close to the graph size) to make each search tiny.
+// BIDIRECTIONAL_DIJKSTRA searches from both ends at once; ALT adds landmark
+// lower bounds to it (two distances per vertex and landmark). RAPTOR builds
+// no graph and scans the bus routes round by round on each request. AUTO
+// estimates the graph routers on the built graph and takes the cheapest that
+// fits into max_router_memory_mb.
+enum class RouterType {
+    ALL_PAIRS,
+    DIJKSTRA,
+    CONTRACTION_HIERARCHY,
+    BIDIRECTIONAL_DIJKSTRA,
+    ALT,
+    RAPTOR,
+    AUTO
+};
+
+// Weights kept by the ALL_PAIRS tables. FLOAT also stores predecessors in
+// the narrowest of 16 and 32 bits that fits the edge count, which takes a
+// cell from 16 bytes down to 6 or 8; reported times stay exact, but routes
+// within float precision of each other count as ties.
+enum class TablePrecision {
+    DOUBLE,
+    FLOAT
+};
+
+// Expected cost of a router on a given graph, on top of the graph itself.
+struct RouterEstimate {
+    RouterType type;
+    double memory_mb = 0.0;
+    double build_ms = 0.0;
+    double query_us = 0.0;
+};
+
+// COMPLETE links every stop to every later stop of each bus (O(k^2) edges per
+// route of k stops); SPLIT adds an on-board vertex per route position and
+// wait/ride/alight edges between them (O(k) edges per route).
+enum class GraphModel {
+    COMPLETE,
+    SPLIT
+};
+
+// How stops are numbered as graph vertices. CATALOGUE keeps the order of
+// catalogue_.GetStops(); HILBERT follows a Hilbert curve over the stop
+// coordinates and RCM (reverse Cuthill-McKee) a breadth-first walk along the
+// bus routes, so that stops close to each other get close ids and searches
+// touch fewer cache lines.
+enum class VertexOrder {
+    CATALOGUE,
+    HILBERT,
+    RCM
+};
+
 struct RoutingSettings {
     int bus_wait_time = 0;
     double bus_velocity = 0.0;
+    RouterType router_type = RouterType::ALL_PAIRS;
+    GraphModel graph_model = GraphModel::COMPLETE;
+    VertexOrder vertex_order = VertexOrder::CATALOGUE;
+    // Threads used to precompute the ALL_PAIRS router.
+    size_t thread_count = 1;
+    TablePrecision table_precision = TablePrecision::DOUBLE;
+    // Routes kept by FindRoute for repeated stop pairs; 0 disables the cache.
+    size_t route_cache_capacity = 0;
+    // Landmarks precomputed for the ALT router.
+    size_t landmark_count = 16;
+    // Memory an AUTO router may take; 0 means no limit.
+    size_t max_router_memory_mb = 0;
+    // Searches the caller is going to run, which AUTO weighs against the
+    // build time.
+    size_t expected_query_count = 0;
+    // Keep only the cheapest of parallel edges between two vertices.
+    bool prune_parallel_edges = false;
+    // Build a hub-label index of the graph for FindRouteTime and
+    // ComputeTravelTimes; there is no graph to index under RAPTOR.
+    bool hub_labels = false;
 };
 
+// Queries are const but not thread-safe: the search engines keep mutable
+// scratch buffers, so one router answers one query at a time. The route
+// cache locks on its own and does not add to this.
 class TransportRouter {
 public:
+    // A found route as its total time and its "items" array, already printed
+    // as JSON; this is what the route cache keeps, so a hit builds no nodes.
+    struct FoundRoute {
+        double total_time = 0.0;
+        std::string items;
+    };
+
     TransportRouter(const transport_catalogue::TransportCatalogue& catalogue, RoutingSettings settings);
+    // Maps the graph and router tables from snapshot_file when it was saved
+    // for the same catalogue and settings; otherwise builds them and saves a
+    // fresh snapshot there.
+    TransportRouter(const transport_catalogue::TransportCatalogue& catalogue, RoutingSettings settings,
+                    const std::filesystem::path& snapshot_file);
 
     std::optional<json::Node> FindRoute(const std::string& from, const std::string& to, int request_id) const;
+    // Only the total time of the route, without its items; empty when a
+    // stop is unknown or there is no route. A label merge with hub_labels,
+    // otherwise one search that skips path reconstruction.
+    std::optional<double> FindRouteTime(const std::string& from, const std::string& to) const;
+    // Routes from one stop to each stop of destinations, sharing a single
+    // search where the engine supports it, in the order of destinations;
+    // null where a stop is unknown or there is no route. Route requests are
+    // written from them with PrintRoute.
+    std::vector<std::shared_ptr<const FoundRoute>> FindRoutes(const std::string& from,
+                                                              const std::vector<std::string>& destinations) const;
+    // Writes the answer to a Route request, as json::Print would the node
+    // FindRoute returns.
+    static void PrintRoute(const FoundRoute& route, int request_id, std::ostream& output);
+    // Stops reachable from a stop within max_time minutes, with their total
+    // travel times, closest first.
+    std::optional<json::Node> FindReachableStops(const std::string& from, double max_time, int request_id) const;
+    // Travel times from every origin to every destination stop, handed to
+    // on_row one origin at a time and in order; unknown stops and
+    // unreachable pairs are empty.
+    void ComputeTravelTimes(const std::vector<std::string>& origins, const std::vector<std::string>& destinations,
+                            const std::function<void(const std::vector<std::optional<double>>&)>& on_row) const;
+
+    cache::CacheStats GetRouteCacheStats() const;
+    graph::SearchStats GetSearchStats() const;
+    // The router in use; never AUTO.
+    RouterType GetRouterType() const;
+    // Every concrete graph router type, estimated on the current graph;
+    // empty under RAPTOR.
+    std::vector<RouterEstimate> EstimateRouters() const;
+
+    // Starts routing a bus added to the catalogue after the router was built,
+    // or one removed earlier. Its edges are appended to the graph and the
+    // all-pairs tables are repaired in O(V^2) per edge; other routers, the
+    // split model and buses through new stops fall back to a rebuild.
+    // Must not run concurrently with queries.
+    void AddBus(std::string_view bus_name);
+    // Stops routing a bus. Routes can only get longer, which the tables
+    // cannot repair in place, so the graph and router are rebuilt.
+    void RemoveBus(std::string_view bus_name);
 
 private:
+    enum class EdgeType : uint8_t {
+        BUS,
+        WAIT,
+        RIDE,
+        ALIGHT
+    };
+
+    // Kept per edge, so it stays a fixed-size POD: the bus is an index into
+    // catalogue_.GetBuses() and the distance ridden, in metres, gives back
+    // exactly the travel time the edge weight was built from (see
+    // GetTravelTime); it is zero for WAIT and ALIGHT edges.
     struct GraphEdgeInfo {
-        std::string bus_name;
-        double travel_time;
-        int span_count;
+        uint32_t bus_index;
+        uint32_t distance;
+        uint16_t span_count;
+        EdgeType type;
     };
 
+    struct VertexPairHasher {
+        size_t operator()(const std::pair<graph::VertexId, graph::VertexId>& pair) const {
+            return std::hash<graph::VertexId>{}(pair.first) * 37 + std::hash<graph::VertexId>{}(pair.second);
+        }
+    };
+
+    // Null for stops that are not connected.
+    using RouteCache = cache::LruCache<std::pair<graph::VertexId, graph::VertexId>,
+                                       std::shared_ptr<const FoundRoute>, VertexPairHasher>;
+
     const transport_catalogue::TransportCatalogue& catalogue_;
     RoutingSettings settings_;
+    RouterType router_type_ = RouterType::ALL_PAIRS;
 
     std::unique_ptr<graph::DirectedWeightedGraph<double>> graph_;
-    std::unique_ptr<graph::Router<double>> router_;
+    // Owns the mapping that a snapshot-loaded router reads from.
+    std::unique_ptr<snapshot::Reader> snapshot_;
+    std::unique_ptr<graph::RouteEngine<double>> router_;
+    // Set instead of graph_ and router_ under RAPTOR.
+    std::unique_ptr<RaptorRouter> raptor_;
+    std::unique_ptr<graph::HubLabels<double>> hub_labels_;
 
-    std::unordered_map<std::string_view, graph::VertexId> stop_name_to_vertex_id_;
+    // Indexed by stop id; stops added to the catalogue later are missing.
+    std::vector<graph::VertexId> stop_id_to_vertex_id_;
     std::vector<std::string_view> vertex_id_to_stop_name_;
     
     std::vector<GraphEdgeInfo> edge_infos_;
+    // Buses whose edges are in the graph, by index in catalogue_.GetBuses().
+    std::vector<bool> routed_buses_;
 
+    std::unique_ptr<RouteCache> route_cache_;
+
+    void RegisterStops();
+    std::optional<graph::VertexId> FindVertex(std::string_view stop_name) const;
+    // Stops in the order of their vertex ids.
+    std::vector<const Stop*> OrderStops() const;
+    std::vector<const Stop*> OrderStopsByCuthillMcKee(const std::vector<const Stop*>& stops) const;
+    uint32_t GetBusIndex(std::string_view bus_name) const;
+    void Rebuild();
     void BuildGraph();
+    void BuildRouter();
+    void BuildRaptorRouter();
+    void BuildHubLabels();
+    std::vector<RouterEstimate> EstimateRouters(size_t vertex_count, size_t edge_count) const;
+    // Calls callback(TableWeight{}, EdgeIndex{}) with the types the
+    // ALL_PAIRS tables use for a graph of edge_count edges.
+    template <typename Callback>
+    void VisitTableLayout(size_t edge_count, Callback callback) const;
+    RouterType ResolveRouterType(size_t vertex_count, size_t edge_count) const;
+    void BuildCompleteGraph();
+    void AddCompleteBusEdges(uint32_t bus_index);
+    void BuildSplitGraph();
+    void PruneParallelEdges();
+
+    template <typename Callback>
+    static void ForEachStopSequence(const Bus& bus, Callback callback);
+
+    std::vector<RouteLeg> MakeRouteLegs(const graph::RouteInfo<double>& route) const;
+    std::shared_ptr<const FoundRoute> MakeFoundRoute(double total_time, const std::vector<RouteLeg>& legs) const;
+
+    void AddEdge(const graph::Edge<double>& edge, GraphEdgeInfo info);
+    double ComputeTravelTime(double distance) const;
+    double GetTravelTime(graph::EdgeId edge_id) const;
+
+    uint64_t ComputeSettingsHash() const;
+    uint64_t ComputeCatalogueHash() const;
+    bool LoadSnapshot(const std::filesystem::path& snapshot_file);
+    // Reports a failed write to stderr instead of throwing.
+    void SaveSnapshot(const std::filesystem::path& snapshot_file) const;
+
     const graph::DirectedWeightedGraph<double>& GetGraph() const;
-    const graph::Router<double>& GetRouter() const;
+    const graph::RouteEngine<double>& GetRouter() const;
 };
 
 }
\ No newline at end of file